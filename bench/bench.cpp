@@ -0,0 +1,559 @@
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "filter.hpp"
+#include "ifile.hpp"
+#include "ofile.hpp"
+#include "pipeline.hpp"
+#include "seq.hpp"
+
+// program name
+#define BENCH_PROGNAME "qfilt_bench"
+
+// generator defaults
+#define DEFAULT_NREADS 200000
+#define DEFAULT_MEAN_LENGTH 250
+#define DEFAULT_SD_LENGTH 50
+#define DEFAULT_PROFILE bench::DECAY
+#define DEFAULT_TAG_FRACTION 0.5
+#define DEFAULT_SEED 1
+#define DEFAULT_DIR "/tmp"
+#define DEFAULT_THREADS 1
+
+namespace bench
+{
+    enum profile_t {
+        FLAT,
+        DECAY,
+        PYRO
+    };
+
+    const char * const profiles[] = { "flat", "decay", "454" };
+
+    class args_t
+    {
+    public:
+        size_t nreads;
+        double mean_length;
+        double sd_length;
+        profile_t profile;
+        std::string tag;
+        double tag_fraction;
+        bool crlf;
+        size_t width;
+        unsigned long seed;
+        const char * dir;
+        bool keep;
+        size_t threads;
+
+        args_t( int, const char ** );
+    };
+
+    // a stage's totals, in records and bytes
+    class timing_t
+    {
+    public:
+        size_t records;
+        size_t bytes;
+        double seconds;
+
+        timing_t() :
+            records( 0 ),
+            bytes( 0 ),
+            seconds( 0.0 )
+        {
+        }
+    };
+
+    typedef std::chrono::steady_clock steady_clock_t;
+
+    static
+    double elapsed( const steady_clock_t::time_point & start )
+    {
+        return std::chrono::duration<double>( steady_clock_t::now() - start ).count();
+    }
+}
+
+static
+void usage( FILE * output )
+{
+    fprintf( output,
+        "usage: " BENCH_PROGNAME " [-h] [-n NREADS] [-l MEAN] [-d SD] [-p PROFILE]\n"
+        "                   [-t TAG] [-T FRACTION] [-r] [-w WIDTH] [-s SEED]\n"
+        "                   [-D DIR] [-k] [-@ THREADS]\n"
+        "\n"
+        "generate synthetic FASTQ and FASTA/QUAL inputs and report the throughput\n"
+        "of each stage of qfilt over them: input scanning (ifile_t), parsing\n"
+        "(parser_t::next), filtering (filter_t::filter_batch) and output formatting\n"
+        "(filter::format)\n"
+        "\n"
+        "optional arguments:\n"
+        "  -h, --help               show this help message and exit\n"
+        "  -n NREADS                number of reads to generate (default=%d)\n"
+        "  -l MEAN                  mean read length (default=%d)\n"
+        "  -d SD                    read length standard deviation (default=%d)\n"
+        "  -p PROFILE               quality profile, one of: flat, decay (scores fall\n"
+        "                           toward the 3' end), 454 (high scores with\n"
+        "                           occasional deep dips) (default=%s)\n"
+        "  -t TAG                   prefix reads with TAG\n"
+        "  -T FRACTION              fraction of reads carrying TAG (default=%g)\n"
+        "  -r                       write CRLF (DOS) line endings\n"
+        "  -w WIDTH                 FASTA and QUAL line width, 0 to not wrap (default=%d)\n"
+        "  -s SEED                  random seed (default=%d)\n"
+        "  -D DIR                   directory for the generated inputs (default=%s)\n"
+        "  -k                       keep the generated inputs\n"
+        "  -@ THREADS               parse FASTQ on THREADS threads (default=%d)\n",
+        DEFAULT_NREADS, DEFAULT_MEAN_LENGTH, DEFAULT_SD_LENGTH,
+        bench::profiles[DEFAULT_PROFILE], DEFAULT_TAG_FRACTION, DEFAULT_WIDTH,
+        DEFAULT_SEED, DEFAULT_DIR, DEFAULT_THREADS
+        );
+}
+
+static
+void help()
+{
+    usage( stdout );
+    exit( 0 );
+}
+
+static
+void error( const char * msg )
+{
+    usage( stderr );
+    fprintf( stderr, BENCH_PROGNAME ": error: %s\n", msg );
+    exit( 1 );
+}
+
+static
+const char * next_arg( int & i, int argc, const char ** argv )
+{
+    i++;
+
+    if ( i == argc )
+        error( "ran out of command line arguments" );
+
+    return argv[i];
+}
+
+static
+double parse_number( const char * str, const char * msg )
+{
+    char * endp = NULL;
+    const double val = strtod( str, &endp );
+
+    if ( !str[0] || *endp || val < 0 )
+        error( msg );
+
+    return val;
+}
+
+namespace bench
+{
+    args_t::args_t( int argc, const char ** argv ) :
+        nreads( DEFAULT_NREADS ),
+        mean_length( DEFAULT_MEAN_LENGTH ),
+        sd_length( DEFAULT_SD_LENGTH ),
+        profile( DEFAULT_PROFILE ),
+        tag_fraction( DEFAULT_TAG_FRACTION ),
+        crlf( false ),
+        width( DEFAULT_WIDTH ),
+        seed( DEFAULT_SEED ),
+        dir( DEFAULT_DIR ),
+        keep( false ),
+        threads( DEFAULT_THREADS )
+    {
+        int i;
+
+        for ( i = 1; i < argc; ++i ) {
+            const char * arg = argv[i];
+
+            if ( !strcmp( arg, "-h" ) || !strcmp( arg, "--help" ) ) help();
+            else if ( !strcmp( arg, "-n" ) ) nreads = parse_number( next_arg( i, argc, argv ), "NREADS must be a positive number" );
+            else if ( !strcmp( arg, "-l" ) ) mean_length = parse_number( next_arg( i, argc, argv ), "MEAN must be a positive number" );
+            else if ( !strcmp( arg, "-d" ) ) sd_length = parse_number( next_arg( i, argc, argv ), "SD must be a positive number" );
+            else if ( !strcmp( arg, "-p" ) ) {
+                const char * str = next_arg( i, argc, argv );
+
+                if ( !strcmp( str, "flat" ) ) profile = FLAT;
+                else if ( !strcmp( str, "decay" ) ) profile = DECAY;
+                else if ( !strcmp( str, "454" ) ) profile = PYRO;
+                else error( "PROFILE must be one of flat, decay or 454" );
+            }
+            else if ( !strcmp( arg, "-t" ) ) tag = next_arg( i, argc, argv );
+            else if ( !strcmp( arg, "-T" ) ) {
+                tag_fraction = parse_number( next_arg( i, argc, argv ), "FRACTION must be between 0 and 1" );
+                if ( tag_fraction > 1 )
+                    error( "FRACTION must be between 0 and 1" );
+            }
+            else if ( !strcmp( arg, "-r" ) ) crlf = true;
+            else if ( !strcmp( arg, "-w" ) ) width = parse_number( next_arg( i, argc, argv ), "WIDTH must be a positive number" );
+            else if ( !strcmp( arg, "-s" ) ) seed = parse_number( next_arg( i, argc, argv ), "SEED must be a positive number" );
+            else if ( !strcmp( arg, "-D" ) ) dir = next_arg( i, argc, argv );
+            else if ( !strcmp( arg, "-k" ) ) keep = true;
+            else if ( !strcmp( arg, "-@" ) ) threads = parse_number( next_arg( i, argc, argv ), "THREADS must be a positive number" );
+            else error( "unknown argument" );
+        }
+
+        if ( !nreads )
+            error( "NREADS must be a positive number" );
+
+        if ( !threads )
+            error( "THREADS must be a positive number" );
+    }
+
+    // synthetic reads ------------------------------------------------------------------------------------------------ //
+
+    class read_t
+    {
+    public:
+        std::string id;
+        std::string seq;
+        // phred scores
+        std::vector<unsigned char> quals;
+    };
+
+    class generator_t
+    {
+    private:
+        const args_t & args;
+        std::mt19937_64 rng;
+        std::normal_distribution<double> length;
+        std::uniform_real_distribution<double> unit;
+        const char * const eol;
+
+        size_t next_length() {
+            const double len = floor( length( rng ) + 0.5 );
+
+            return len < 1.0 ? 1 : size_t( len );
+        }
+
+        unsigned char next_score( const size_t i, const size_t n ) {
+            const double x = double( i ) / n;
+            double q;
+
+            switch ( args.profile ) {
+            case FLAT:
+                q = 30.0 + 10.0 * unit( rng );
+                break;
+            case DECAY:
+                q = 38.0 - 25.0 * x * x + 8.0 * ( unit( rng ) - 0.5 );
+                break;
+            case PYRO:
+            default:
+                q = unit( rng ) < 0.03 ? 15.0 * unit( rng ) : 35.0 + 5.0 * unit( rng );
+                break;
+            }
+
+            return q < 0.0 ? 0 : ( q > 41.0 ? 41 : ( unsigned char )( q ) );
+        }
+
+    public:
+        generator_t( const args_t & args ) :
+            args( args ),
+            rng( args.seed ),
+            length( args.mean_length, args.sd_length ),
+            unit( 0.0, 1.0 ),
+            eol( args.crlf ? "\r\n" : "\n" )
+        {
+        }
+
+        void next( const size_t i, read_t & seq ) {
+            static const char bases[] = "ACGT";
+            const size_t tagged = ( args.tag.length() && unit( rng ) < args.tag_fraction ) ? args.tag.length() : 0;
+            const size_t n = tagged + next_length();
+            char id[64];
+            size_t j;
+
+            sprintf( id, "bench%09lu length=%lu", ( unsigned long ) i, ( unsigned long ) n );
+
+            seq.id = id;
+            seq.seq.assign( args.tag, 0, tagged );
+            seq.quals.resize( n );
+
+            for ( j = tagged; j < n; ++j )
+                seq.seq.push_back( bases[rng() & 3] );
+
+            for ( j = 0; j < n; ++j ) {
+                seq.quals[j] = next_score( j, n );
+                // the worst bases are ambiguous
+                if ( seq.quals[j] < 3 )
+                    seq.seq[j] = 'N';
+            }
+        }
+
+        void fastq( FILE * file, const read_t & seq ) const {
+            size_t i;
+
+            fprintf( file, "@%s%s%s%s+%s", seq.id.c_str(), eol, seq.seq.c_str(), eol, eol );
+
+            for ( i = 0; i < seq.seq.length(); ++i )
+                fputc( seq.quals[i] + 33, file );
+
+            fputs( eol, file );
+        }
+
+        void fasta( FILE * file, const read_t & seq ) const {
+            size_t i;
+
+            fprintf( file, ">%s%s", seq.id.c_str(), eol );
+
+            for ( i = 0; i < seq.seq.length(); ++i ) {
+                fputc( seq.seq[i], file );
+                if ( i + 1 == seq.seq.length() || ( args.width && ( i + 1 ) % args.width == 0 ) )
+                    fputs( eol, file );
+            }
+        }
+
+        void qual( FILE * file, const read_t & seq ) const {
+            size_t i;
+
+            fprintf( file, ">%s%s", seq.id.c_str(), eol );
+
+            for ( i = 0; i < seq.seq.length(); ++i ) {
+                fprintf( file, "%d ", seq.quals[i] );
+                if ( i + 1 == seq.seq.length() || ( args.width && ( i + 1 ) % args.width == 0 ) )
+                    fputs( eol, file );
+            }
+        }
+    };
+
+    static
+    FILE * create( const std::string & path )
+    {
+        FILE * file = fopen( path.c_str(), "wb" );
+
+        if ( !file ) {
+            fprintf( stderr, BENCH_PROGNAME ": error: failed to open file: %s\n", path.c_str() );
+            exit( 1 );
+        }
+
+        return file;
+    }
+
+    static
+    size_t file_size( const std::string & path )
+    {
+        struct stat st;
+
+        if ( stat( path.c_str(), &st ) ) {
+            fprintf( stderr, BENCH_PROGNAME ": error: failed to stat file: %s\n", path.c_str() );
+            exit( 1 );
+        }
+
+        return st.st_size;
+    }
+
+    static
+    void generate( const args_t & args, const std::string & fastq, const std::string & fasta, const std::string & qual )
+    {
+        generator_t gen( args );
+        read_t seq;
+        FILE * fq = create( fastq ),
+             * fa = create( fasta ),
+             * qa = create( qual );
+        size_t i;
+
+        for ( i = 0; i < args.nreads; ++i ) {
+            gen.next( i, seq );
+            gen.fastq( fq, seq );
+            gen.fasta( fa, seq );
+            gen.qual( qa, seq );
+        }
+
+        fclose( fq );
+        fclose( fa );
+        fclose( qa );
+    }
+
+    // stages --------------------------------------------------------------------------------------------------------- //
+
+    // read a file line by line, as the parser's id and sequence scans do
+    static
+    void scan( const std::string & path, timing_t & t )
+    {
+        const steady_clock_t::time_point start = steady_clock_t::now();
+        ifile::ifile_t file( path.c_str() );
+        std::string line;
+
+        while ( true ) {
+            line.clear();
+            file.extend_until( line, "\n", false );
+            if ( file.getc() == EOF )
+                break;
+            t.records += 1;
+        }
+
+        t.seconds += elapsed( start );
+        t.bytes += file_size( path );
+    }
+
+    static
+    void parse( seq::parser_t & parser, std::vector<seq::seq_t> & reads, seq::arena_t & arena, size_t bytes, timing_t & t )
+    {
+        const steady_clock_t::time_point start = steady_clock_t::now();
+        seq::seq_t seq;
+
+        for ( ; parser.next( seq, arena ); seq.clear() )
+            reads.push_back( seq );
+
+        t.seconds += elapsed( start );
+        t.records += reads.size();
+        t.bytes += bytes;
+    }
+
+    static
+    void filter( const std::vector<seq::seq_t> & reads, std::vector<filter::fragments_t> & batches, timing_t & t )
+    {
+        filter::settings_t settings;
+        settings.split = true;
+        const filter::filter_t filter( settings );
+        filter::counts_t counts;
+        const steady_clock_t::time_point start = steady_clock_t::now();
+        size_t i, j;
+
+        for ( i = 0, j = 0; i < reads.size(); i += BATCH_SZ, ++j ) {
+            const size_t n = reads.size() - i < BATCH_SZ ? reads.size() - i : BATCH_SZ;
+
+            batches[j].clear();
+            filter.filter_batch( &reads[i], n, counts, batches[j] );
+        }
+
+        t.seconds += elapsed( start );
+        t.records += reads.size();
+        t.bytes += counts.total_bases;
+    }
+
+    static
+    void format( const std::vector<seq::seq_t> & reads, const std::vector<filter::fragments_t> & batches, const bool fastq, timing_t & t )
+    {
+        const ofile::writer_t writer( fastq, DEFAULT_WIDTH );
+        const steady_clock_t::time_point start = steady_clock_t::now();
+        ofile::buffer_t out;
+        size_t i;
+
+        for ( i = 0; i < batches.size(); ++i ) {
+            out.clear();
+            filter::format( writer, &reads[i * BATCH_SZ], batches[i], &out );
+            t.records += batches[i].list.size();
+            t.bytes += out.size();
+        }
+
+        t.seconds += elapsed( start );
+    }
+
+    static
+    void report( const char * input, const char * stage, const char * unit, const timing_t & t )
+    {
+        fprintf( stdout,
+            "%-10s %-8s %12.0f %-10s %10.1f MB/s %10.3f s\n",
+            input,
+            stage,
+            t.records / t.seconds,
+            unit,
+            t.bytes / t.seconds / 1e6,
+            t.seconds
+            );
+    }
+
+    // time each stage over the input in paths: a FASTQ file, or a FASTA and a QUAL file
+    static
+    void run( const char * input, const std::vector<std::string> & paths, const size_t nthreads )
+    {
+        const bool fastq = paths.size() == 1;
+        std::vector<seq::seq_t> reads;
+        // every read is kept, so the arena is never reset
+        seq::arena_t arena;
+        timing_t tscan, tparse, tfilter, tformat;
+        size_t i;
+
+        for ( i = 0; i < paths.size(); ++i )
+            scan( paths[i], tscan );
+
+        // the FASTA and QUAL readers start on construction, so only open them now
+        std::vector<ifile::ifile_t *> files;
+        seq::parser_t * parser;
+
+        for ( i = 0; i < paths.size(); ++i )
+            files.push_back( new ifile::ifile_t( paths[i].c_str() ) );
+
+        if ( fastq )
+            parser = new seq::parser_t( files[0], nthreads );
+        else
+            parser = new seq::parser_t( files[0], files[1] );
+
+        parse( *parser, reads, arena, tscan.bytes, tparse );
+
+        delete parser;
+
+        // fragments_t is not copyable, so size its vector up front
+        std::vector<filter::fragments_t> batches( ( reads.size() + BATCH_SZ - 1 ) / BATCH_SZ );
+
+        filter( reads, batches, tfilter );
+        format( reads, batches, fastq, tformat );
+
+        // reads may be views of the (mapped) input, so only close it now
+        reads.clear();
+
+        for ( i = 0; i < files.size(); ++i )
+            delete files[i];
+
+        report( input, "scan", "lines/s", tscan );
+        report( input, "parse", "reads/s", tparse );
+        report( input, "filter", "reads/s", tfilter );
+        report( input, "format", "frags/s", tformat );
+    }
+}
+
+// main ------------------------------------------------------------------------------------------------------------- //
+
+int main( int argc, const char * argv[] )
+{
+    const bench::args_t args( argc, argv );
+    const std::string base = std::string( args.dir ) + "/" BENCH_PROGNAME "." + std::to_string( ( long ) getpid() ),
+                      fastq = base + ".fastq",
+                      fasta = base + ".fna",
+                      qual = base + ".qual";
+
+    bench::generate( args, fastq, fasta, qual );
+
+    fprintf( stdout,
+        "%lu reads, length %g +/- %g, %s profile, %s line endings\n\n",
+        ( unsigned long ) args.nreads,
+        args.mean_length,
+        args.sd_length,
+        bench::profiles[args.profile],
+        args.crlf ? "CRLF" : "LF"
+        );
+
+    fprintf( stdout, "%-10s %-8s %-23s %15s %12s\n", "input", "stage", "rate", "throughput", "time" );
+
+    bench::run( "FASTQ", std::vector<std::string>( 1, fastq ), args.threads );
+
+    {
+        std::vector<std::string> paths;
+
+        paths.push_back( fasta );
+        paths.push_back( qual );
+
+        bench::run( "FASTA/QUAL", paths, args.threads );
+    }
+
+    if ( !args.keep ) {
+        unlink( fastq.c_str() );
+        unlink( fasta.c_str() );
+        unlink( qual.c_str() );
+    }
+    else
+        fprintf( stdout, "\ninputs kept in %s.{fastq,fna,qual}\n", base.c_str() );
+
+    return 0;
+}
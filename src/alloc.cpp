@@ -0,0 +1,28 @@
+
+#include <cstdlib>
+
+#include "profile.hpp"
+
+// replace the global allocation functions, so every container and string counts;
+// the nothrow and sized forms forward to these. Linked into the qfilt executable
+// only, so that a program using libqfilt keeps its own allocator
+
+void * operator new( size_t n )
+{
+    return profile::allocate( n );
+}
+
+void * operator new[]( size_t n )
+{
+    return profile::allocate( n );
+}
+
+void operator delete( void * ptr ) noexcept
+{
+    free( ptr );
+}
+
+void operator delete[]( void * ptr ) noexcept
+{
+    free( ptr );
+}
@@ -1,12 +1,14 @@
 
 /* argument parsing ------------------------------------------------------------------------------------------------- */
 
+#include <cctype>
 #include <cstdarg>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
 
 #include "argparse.hpp"
+#include "tag.hpp"
 
 // some crazy shit for stringifying preprocessor directives
 #define STRIFY(x) #x
@@ -18,16 +20,24 @@ namespace argparse
         "usage: " PROGNAME " [-h] "
         "[-v] "
         "[-o OUTPUT] "
+        "[-z] "
         "[-q QSCORE] "
         "[-l LENGTH] "
         "[-m MODE] [-s] [-p] [-a] "
+        "[-W WINDOW] "
         "[-P CHAR] "
         "[-T PREFIX] "
         "[-t MISMATCH] "
+        "[-e WINDOW] "
+        "[-B BARCODES] "
+        "[-d] [-M MEMORY] [-D DEREP] "
         "[-R COUNT] "
         "[-f] "
+        "[-w WIDTH] "
         "[-j] "
-        "( -F FASTA QUAL | -Q FASTQ )\n";
+        "[-X] "
+        "[-@ THREADS] "
+        "( -F FASTA QUAL | -Q FASTQ [-2 FASTQ] [-u POLICY] )\n";
 
     const char help_msg[] =
         "filter sequencing data using some simple heuristics\n"
@@ -35,11 +45,27 @@ namespace argparse
         "required arguments:\n"
         "  -F FASTA QUAL            FASTA and QUAL files\n"
         "  -Q FASTQ                 FASTQ file\n"
+        "                           (input files may be gzip or BGZF compressed)\n"
+        "  -2 FASTQ                 paired-end reads: the second mate of each read of -Q FASTQ, in the\n"
+        "                           same order; each mate is filtered as a read of its own (PREFIX only\n"
+        "                           applies to the first), and the pairs are written to OUTPUTR1.fasta\n"
+        "                           and OUTPUTR2.fasta (or .fastq, and then .gz with -z), and unpaired\n"
+        "                           mates to OUTPUTsingletons.fasta: OUTPUT is a path prefix;\n"
+        "                           incompatible with -s and -B. The run summary counts the reads of\n"
+        "                           both mates, and of their fragments, only those written\n"
+        "  -u POLICY                with -2, when only one mate of a pair has a fragment retained:\n"
+        "                           'pair' writes both, the other mate whole, 'orphan' writes the one\n"
+        "                           to singletons, and 'drop' writes neither (default=orphan); with -T,\n"
+        "                           'pair' drops a pair rather than write the first mate whole,\n"
+        "                           with its PREFIX still on it\n"
         "\n"
         "optional arguments:\n"
         "  -h, --help               show this help message and exit\n"
         "  -v, --version            show current version and exit\n"
         "  -o OUTPUT                direct retained fragments to a file named OUTPUT (default=stdout)\n"
+        "  -z                       compress the output as BGZF (gzip-compatible); implied when\n"
+        "                           OUTPUT ends in .gz. Not DEREP, which is compressed only\n"
+        "                           when it ends in .gz\n"
         "  -q QSCORE                minimum per-base quality score below which a read will be split\n"
         "                           or truncated (default=" TO_STR( DEFAULT_MIN_QSCORE ) ")\n"
         "  -l LENGTH                minimum retained fragment LENGTH (default=" TO_STR( DEFAULT_MIN_LENGTH ) ")\n"
@@ -50,6 +76,10 @@ namespace argparse
         "  -s                       when encountering a low q-score, split instead of truncate\n"
         "  -p                       tolerate low q-score homopolymeric regions\n"
         "  -a                       tolerate low q-score ambiguous nucleotides\n"
+        "  -W WINDOW                rather than at the first base below QSCORE, split or truncate at\n"
+        "                           the first WINDOW bases whose mean q-score is below QSCORE, trimming\n"
+        "                           low q-score bases from the ends of each fragment;\n"
+        "                           incompatible with -P, -p and -a\n"
         "  -P CHAR                  rather than splitting or truncating, replace low quality bases with CHAR\n"
         "                           this option OVERRIDES all -m mode options\n"
         "  -R COUNT                 rather than splitting or truncating, remove reads which \n"
@@ -59,8 +89,35 @@ namespace argparse
         "                           and the PREFIX is stripped from each contributing read\n"
         "  -t MISMATCH              if PREFIX is supplied, prefix matching tolerates at most\n"
         "                           MISMATCH mismatches (default=" TO_STR( DEFAULT_TAG_MISMATCH ) ")\n"
+        "  -e WINDOW                rather than at the 5' end, search for PREFIX (up to 64 bases) within\n"
+        "                           the first WINDOW bases, tolerating MISMATCH substitutions, insertions\n"
+        "                           and deletions, and strip everything through the end of its best match\n"
+        "  -B BARCODES              demultiplex: BARCODES is a tab-separated table of SAMPLE and\n"
+        "                           BARCODE, one per line; each read is assigned to the sample whose\n"
+        "                           BARCODE (all of A, C, G and T, of equal lengths, up to 32) its 5' end\n"
+        "                           matches, with at most MISMATCH mismatches, and that is stripped as\n"
+        "                           PREFIX would be. Reads equally near two BARCODES are dropped.\n"
+        "                           Each sample is written to OUTPUTSAMPLE.fasta (or .fastq,\n"
+        "                           and then .gz with -z): OUTPUT is a path prefix; incompatible with -T\n"
+        "  -d                       drop duplicate fragments, keeping the first of each\n"
+        "  -M MEMORY                with -d, the megabytes of memory to track fragments in: past half of\n"
+        "                           MEMORY, fragments not yet seen are tracked approximately, in a Bloom\n"
+        "                           filter of the other half, which drops a few unique fragments as\n"
+        "                           duplicates (default=" TO_STR( DEFAULT_DEDUP_MEMORY ) ")\n"
+        "  -D DEREP                 with -d (implied), write each unique fragment to the FASTA file DEREP,\n"
+        "                           most abundant first, as \">ID;size=N\", where ID is the ID of its first\n"
+        "                           read and N the number of its copies; incompatible with -2, and\n"
+        "                           fragments first seen once past half of MEMORY are left out\n"
         "  -f FORMAT                output in FASTA or FASTQ format (default=" TO_STR( DEFAULT_FORMAT ) ")\n"
-        "  -j                       output run diagnostics to stderr as JSON (default is to write ASCII text)\n";
+        "  -w WIDTH                 wrap FASTA fragment sequences at WIDTH characters per line,\n"
+        "                           or 0 to not wrap them (default=" TO_STR( DEFAULT_WIDTH ) ")\n"
+        "  -j                       output run diagnostics to stderr as JSON (default is to write ASCII text)\n"
+        "  -X                       add a profile to the run diagnostics: wall and CPU time spent parsing,\n"
+        "                           gathering stats, filtering and writing output, bytes read and written,\n"
+        "                           reads per second, peak memory use, and allocation counts\n"
+        "  -@ THREADS               filter reads on THREADS worker threads, with parsing and output\n"
+        "                           on threads of their own; an uncompressed FASTQ file is also\n"
+        "                           parsed on THREADS threads (default=" TO_STR( DEFAULT_THREADS ) ")\n";
 
     inline
     void help()
@@ -101,15 +158,28 @@ namespace argparse
         fasta( NULL ),
         fastq( NULL ),
         qual ( NULL ),
-        output( stdout ),
+        mates( NULL ),
+        pairing( DEFAULT_PAIRING ),
         min_length( DEFAULT_MIN_LENGTH ),
         min_qscore( DEFAULT_MIN_QSCORE ),
+        window( 0 ),
         json( false ),
+        profile( false ),
+        compress( false ),
         punch( '\0' ),
         tag_length( 0 ),
         tag_mismatch( DEFAULT_TAG_MISMATCH ),
+        tag_window( 0 ),
+        barcode_path( NULL ),
+        dedup( false ),
+        dedup_memory( DEFAULT_DEDUP_MEMORY ),
+        derep_path( NULL ),
+        derep( NULL ),
         format( DEFAULT_FORMAT ),
-        remove_count (DEFAULT_REMOVE_COUNT)
+        width( DEFAULT_WIDTH ),
+        remove_count (DEFAULT_REMOVE_COUNT),
+        threads( DEFAULT_THREADS ),
+        output_path( NULL )
     {
         int i;
         // make sure tag is an empty string
@@ -144,12 +214,24 @@ namespace argparse
                 else if ( !strcmp( &arg[1], "s" ) ) parse_split();
                 else if ( !strcmp( &arg[1], "p" ) ) parse_hpoly();
                 else if ( !strcmp( &arg[1], "a" ) ) parse_ambig();
+                else if ( !strcmp( &arg[1], "W" ) ) parse_window( next_arg (i, argc, argv) );
                 else if ( !strcmp( &arg[1], "j" ) ) parse_json();
+                else if ( !strcmp( &arg[1], "X" ) ) parse_profile();
+                else if ( !strcmp( &arg[1], "z" ) ) parse_compress();
                 else if ( !strcmp( &arg[1], "P" ) ) parse_punch( next_arg (i, argc, argv) );
                 else if ( !strcmp( &arg[1], "R" ) ) parse_remove_count( next_arg (i, argc, argv) );
                 else if ( !strcmp( &arg[1], "T" ) ) parse_tag( next_arg (i, argc, argv) );
                 else if ( !strcmp( &arg[1], "t" ) ) parse_tagmismatch( next_arg (i, argc, argv) );
+                else if ( !strcmp( &arg[1], "e" ) ) parse_tagwindow( next_arg (i, argc, argv) );
+                else if ( !strcmp( &arg[1], "2" ) ) parse_mates( next_arg (i, argc, argv) );
+                else if ( !strcmp( &arg[1], "u" ) ) parse_pairing( next_arg (i, argc, argv) );
+                else if ( !strcmp( &arg[1], "B" ) ) parse_barcodes( next_arg (i, argc, argv) );
+                else if ( !strcmp( &arg[1], "d" ) ) parse_dedup();
+                else if ( !strcmp( &arg[1], "M" ) ) parse_dedup_memory( next_arg (i, argc, argv) );
+                else if ( !strcmp( &arg[1], "D" ) ) parse_derep( next_arg (i, argc, argv) );
                 else if ( !strcmp( &arg[1], "f" ) ) parse_format( next_arg (i, argc, argv) );
+                else if ( !strcmp( &arg[1], "w" ) ) parse_width( next_arg (i, argc, argv) );
+                else if ( !strcmp( &arg[1], "@" ) ) parse_threads( next_arg (i, argc, argv) );
                 else
                     ERROR( "unknown argument: %s", arg );
             }
@@ -162,6 +244,38 @@ namespace argparse
 
         if ( punch && ( split || hpoly || ambig ) )
             ERROR( "-P CHAR is incompatible with any of -s, -p, and -a" );
+
+        if ( window && ( punch || hpoly || ambig ) )
+            ERROR( "-W WINDOW is incompatible with any of -P, -p, and -a" );
+
+        if ( tag_length && barcode_path )
+            ERROR( "-T PREFIX and -B BARCODES are mutually exclusive" );
+
+        if ( mates && !fastq )
+            ERROR( "-2 FASTQ requires -Q FASTQ" );
+
+        if ( mates && split )
+            ERROR( "-2 FASTQ is incompatible with -s" );
+
+        if ( mates && barcode_path )
+            ERROR( "-2 FASTQ and -B BARCODES are mutually exclusive" );
+
+        if ( mates && !strcmp( mates->path, "-" ) && !strcmp( fastq->path, "-" ) )
+            ERROR( "only one of -Q FASTQ and -2 FASTQ can be STDIN" );
+
+        if ( dedup && mates )
+            ERROR( "-d and -D are incompatible with -2 FASTQ" );
+
+        if ( tag_window && !tag_length )
+            ERROR( "-e WINDOW requires -T PREFIX" );
+
+        if ( tag_window && tag_length > TAG_SEARCH_BASES )
+            ERROR( "-e WINDOW supports a PREFIX of at most %d bases, had %ld", TAG_SEARCH_BASES, tag_length );
+
+        if ( tag_window && tag_window < tag_length )
+            ERROR( "-e WINDOW must be at least the length of PREFIX (%ld), had: %ld", tag_length, tag_window );
+
+        open_outputs();
     }
 
     args_t::~args_t() {
@@ -171,8 +285,12 @@ namespace argparse
             delete fastq;
         if ( qual )
             delete qual;
-        if ( output && output != stdin )
-            fclose( output );
+        if ( mates )
+            delete mates;
+        for ( size_t i = 0; i < outputs.size(); ++i )
+            delete outputs[i];
+        if ( derep )
+            delete derep;
     }
 
     void args_t::parse_fasta( const char * fstr, const char * qstr )
@@ -204,15 +322,74 @@ namespace argparse
             ERROR( "failed to open the FASTQ file %s", str );
     }
 
-    void args_t::parse_output( const char * str )
+    void args_t::parse_mates( const char * str )
+    {
+        mates = new ifile::ifile_t( str );
+
+        if ( !mates->good() )
+            ERROR( "failed to open the FASTQ file %s", str );
+    }
+
+    void args_t::parse_pairing( const char * str )
     {
-        if ( str && strcmp( str, "-" ) )
-            output = fopen( str, "wb" );
+        if ( !strcmp( str, "pair" ) )
+            pairing = PAIR;
+        else if ( !strcmp( str, "orphan" ) )
+            pairing = ORPHAN;
+        else if ( !strcmp( str, "drop" ) )
+            pairing = DROP;
         else
-            output = stdin;
+            ERROR( "invalid pairing policy %s", str );
+    }
+
+    // once all the arguments are in, as the outputs depend on -B, -2, -f and -z
+    void args_t::open_outputs()
+    {
+        const char * const pair_names[] = { "R1", "R2", "singletons" };
+        std::vector<std::string> names;
+        size_t i;
+
+        if ( barcode_path )
+            names = samples;
+        else if ( mates )
+            names.assign( pair_names, pair_names + 3 );
+
+        if ( names.empty() )
+            output_paths.push_back( output_path ? output_path : "-" );
+        else
+            for ( i = 0; i < names.size(); ++i )
+                output_paths.push_back(
+                    std::string( output_path ? output_path : "" )
+                    + names[i]
+                    + ( format == FASTQ ? ".fastq" : ".fasta" )
+                    + ( compress ? ".gz" : "" )
+                    );
+
+        // output_paths is left alone from here on, as each ofile_t keeps its path
+        for ( i = 0; i < output_paths.size(); ++i ) {
+            ofile::ofile_t * output = new ofile::ofile_t( output_paths[i].c_str() );
+
+            if ( !output->good() )
+                ERROR( "failed to open the OUTPUT file %s", output_paths[i].c_str() );
+
+            if ( compress )
+                output->compress();
 
-        if ( !output )
-            ERROR( "failed to open the OUTPUT file %s", str );
+            outputs.push_back( output );
+        }
+
+        if ( derep_path ) {
+            // -z is for the fragment outputs; DEREP is compressed by its own name alone
+            derep = new ofile::ofile_t( derep_path );
+
+            if ( !derep->good() )
+                ERROR( "failed to open the DEREP file %s", derep_path );
+        }
+    }
+
+    void args_t::parse_output( const char * str )
+    {
+        output_path = str;
     }
 
     void args_t::parse_minlength( const char * str )
@@ -262,11 +439,31 @@ namespace argparse
         ambig = true;
     }
 
+    void args_t::parse_window( const char * str )
+    {
+        long val = atoi( str );
+
+        if ( val < 1 )
+            ERROR( "window width expected a positive integer, had: %s", str );
+
+        window = size_t( val );
+    }
+
     void args_t::parse_json()
     {
         json = true;
     }
 
+    void args_t::parse_profile()
+    {
+        profile = true;
+    }
+
+    void args_t::parse_compress()
+    {
+        compress = true;
+    }
+
     void args_t::parse_punch( const char * str )
     {
         const size_t len = strlen( str );
@@ -307,6 +504,99 @@ namespace argparse
         tag_mismatch = size_t( val );
     }
 
+    void args_t::parse_tagwindow( const char * str )
+    {
+        long val = atoi( str );
+
+        if ( val < 1 )
+            ERROR( "tag search window expected a positive integer, had: %s", str );
+
+        tag_window = size_t( val );
+    }
+
+    // SAMPLE<tab>BARCODE lines; blank lines and lines starting with '#' are skipped
+    void args_t::parse_barcodes( const char * str )
+    {
+        FILE * file = fopen( str, "r" );
+        char line[1024];
+        size_t nline = 0,
+               i, j;
+
+        if ( !file )
+            ERROR( "failed to open the BARCODES file %s", str );
+
+        barcode_path = str;
+        samples.clear();
+        barcodes.clear();
+
+        while ( fgets( line, sizeof( line ), file ) ) {
+            char * tab = strchr( line, '\t' ),
+                 * end = line + strcspn( line, "\r\n" );
+
+            nline += 1;
+            *end = '\0';
+
+            if ( line[0] == '\0' || line[0] == '#' )
+                continue;
+
+            if ( !tab || tab == line || tab + 1 == end )
+                ERROR( "malformed BARCODES file %s, line %ld: expected SAMPLE<tab>BARCODE", str, nline );
+
+            samples.push_back( std::string( line, tab ) );
+            barcodes.push_back( std::string( tab + 1, end ) );
+
+            std::string & barcode = barcodes.back();
+
+            for ( j = 0; j < barcode.length(); ++j ) {
+                barcode[j] = toupper( barcode[j] );
+
+                if ( !strchr( "ACGT", barcode[j] ) )
+                    ERROR( "barcode %s of sample %s has a base other than A, C, G or T", barcode.c_str(), samples.back().c_str() );
+            }
+
+            if ( barcode.length() > 32 )
+                ERROR( "barcode %s of sample %s is longer than 32 bases", barcode.c_str(), samples.back().c_str() );
+
+            if ( barcode.length() != barcodes[0].length() )
+                ERROR( "barcode %s of sample %s differs in length from the first, %s", barcode.c_str(), samples.back().c_str(), barcodes[0].c_str() );
+        }
+
+        fclose( file );
+
+        if ( barcodes.empty() )
+            ERROR( "the BARCODES file %s has no barcodes", str );
+
+        for ( i = 0; i < barcodes.size(); ++i )
+            for ( j = 0; j < i; ++j ) {
+                if ( samples[i] == samples[j] )
+                    ERROR( "sample %s is listed twice", samples[i].c_str() );
+
+                if ( barcodes[i] == barcodes[j] )
+                    ERROR( "samples %s and %s share the barcode %s", samples[j].c_str(), samples[i].c_str(), barcodes[i].c_str() );
+            }
+    }
+
+    void args_t::parse_dedup()
+    {
+        dedup = true;
+    }
+
+    void args_t::parse_dedup_memory( const char * str )
+    {
+        long val = atoi( str );
+
+        if ( val < 1 )
+            ERROR( "dedup memory expected a positive integer, had: %s", str );
+
+        dedup_memory = size_t( val );
+    }
+
+    void args_t::parse_derep( const char * str )
+    {
+        dedup = true;
+        derep_path = str;
+    }
+
     void args_t::parse_format( const char * str )
     {
         if ( !strcmp( str, "FASTA" ) )
@@ -316,4 +606,24 @@ namespace argparse
         else
             ERROR( "invalid format %s", str );
     }
+
+    void args_t::parse_width( const char * str )
+    {
+        long val = atoi( str );
+
+        if ( val < 0 )
+            ERROR( "line width expected a non-negative integer, had: %s", str );
+
+        width = size_t( val );
+    }
+
+    void args_t::parse_threads( const char * str )
+    {
+        long val = atoi( str );
+
+        if ( val < 1 )
+            ERROR( "number of threads expected a positive integer, had: %s", str );
+
+        threads = size_t( val );
+    }
 }
@@ -2,7 +2,11 @@
 #ifndef ARGPARSE_H
 #define ARGPARSE_H
 
+#include <string>
+#include <vector>
+
 #include "ifile.hpp"
+#include "ofile.hpp"
 #include "limits.h"
 // program name
 #define PROGNAME "qfilt"
@@ -14,6 +18,10 @@
 #define DEFAULT_TAG_MISMATCH 0
 #define DEFAULT_FORMAT FASTA
 #define DEFAULT_REMOVE_COUNT (ULONG_MAX)
+#define DEFAULT_THREADS 1
+#define DEFAULT_WIDTH 60
+#define DEFAULT_PAIRING ORPHAN
+#define DEFAULT_DEDUP_MEMORY 512
 
 #ifndef VERSION_NUMBER
 #define VERSION_NUMBER            "UNKNOWN"
@@ -27,30 +35,66 @@ namespace argparse
         FASTQ
     };
 
+    // what becomes of a pair when only one of its mates has a fragment retained:
+    // both are written, the one is written as a singleton, or neither is
+    enum pairing_t {
+        PAIR,
+        ORPHAN,
+        DROP
+    };
+
     class args_t
     {
     public:
         ifile::ifile_t * fasta;
         ifile::ifile_t * fastq;
         ifile::ifile_t * qual;
-        FILE * output;
+        // for paired-end reads, the second mates, in step with fastq
+        ifile::ifile_t * mates;
+        pairing_t pairing;
+        // a single output, or when demultiplexing, one per sample,
+        // or for paired-end reads, first mates, second mates and singletons
+        std::vector<ofile::ofile_t *> outputs;
         size_t min_length;
         size_t min_qscore;
         bool split; // split not truncate
         bool hpoly; // tolerate homopolymers
         bool ambig; // tolerate ambigs ('N')
+        size_t window; // sliding window width, 0 for per-base
         bool json; // diagnostics to JSON
+        bool profile; // timings and counters in the diagnostics
+        bool compress; // BGZF output
         char punch;
         char tag[256];
         size_t tag_length;
         size_t tag_mismatch;
+        // search for the tag within this many bases, tolerating indels, 0 for a prefix match
+        size_t tag_window;
+        // the barcode table, its samples, and their barcodes
+        const char * barcode_path;
+        std::vector<std::string> samples;
+        std::vector<std::string> barcodes;
+        // drop duplicate fragments, within a memory cap in megabytes,
+        // and write the unique ones, with their abundances, to derep
+        bool dedup;
+        size_t dedup_memory;
+        const char * derep_path;
+        ofile::ofile_t * derep;
         format_t format;
+        size_t width;
         unsigned long   remove_count;
+        size_t threads;
 
         args_t( int, const char ** );
         ~args_t();
     private:
+        const char * output_path;
+        std::vector<std::string> output_paths;
+
+        void open_outputs();
         void parse_fastq( const char * );
+        void parse_mates( const char * );
+        void parse_pairing( const char * );
         void parse_fasta( const char *, const char * );
         void parse_output( const char * );
         void parse_minlength( const char * );
@@ -60,11 +104,21 @@ namespace argparse
         void parse_hpoly();
         void parse_ambig();
         void parse_punch( const char * );
+        void parse_window( const char * );
         void parse_json();
+        void parse_profile();
+        void parse_compress();
         void parse_tag( const char * );
         void parse_tagmismatch( const char * );
+        void parse_tagwindow( const char * );
+        void parse_barcodes( const char * );
+        void parse_dedup();
+        void parse_dedup_memory( const char * );
+        void parse_derep( const char * );
         void parse_format( const char * );
+        void parse_width( const char * );
         void parse_remove_count ( const char * );
+        void parse_threads( const char * );
     };
 }
 
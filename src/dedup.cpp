@@ -0,0 +1,297 @@
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+#include "dedup.hpp"
+
+namespace dedup
+{
+    static inline
+    uint64_t rotl( const uint64_t x, const unsigned r )
+    {
+        return ( x << r ) | ( x >> ( 64 - r ) );
+    }
+
+    // the bases of a fragment, punched or the read's own
+    static inline
+    const char * bases( const seq::seq_t & seq, const filter::fragments_t & frags, const filter::fragment_t & frag )
+    {
+        if ( frag.bases != filter::fragment_t::npos )
+            return frags.bases.data() + frag.bases;
+
+        return seq.seq.data() + frag.from;
+    }
+
+    // 8 bytes a round, then the murmur3 finalizer
+    uint64_t fingerprint( const char * str, const size_t n, const uint64_t seed )
+    {
+        const uint64_t k1 = UINT64_C( 0x9e3779b97f4a7c15 ),
+                       k2 = UINT64_C( 0xc2b2ae3d27d4eb4f );
+        uint64_t h = n * k2 + seed * k1,
+                 w;
+        size_t i;
+
+        for ( i = 0; i + 8 <= n; i += 8 ) {
+            memcpy( &w, str + i, 8 );
+            h ^= rotl( w * k2, 31 ) * k1;
+            h = rotl( h, 27 ) * k1 + UINT64_C( 0x52dce729 );
+        }
+
+        if ( i < n ) {
+            w = 0;
+            memcpy( &w, str + i, n - i );
+            h ^= rotl( w * k2, 31 ) * k1;
+        }
+
+        h ^= h >> 33;
+        h *= UINT64_C( 0xff51afd7ed558ccd );
+        h ^= h >> 33;
+        h *= UINT64_C( 0xc4ceb9fe1a85ec53 );
+        h ^= h >> 33;
+
+        return h ? h : 1;
+    }
+
+    void fingerprints( const seq::seq_t * reads, const filter::fragments_t & frags, std::vector<uint64_t> & prints )
+    {
+        size_t i;
+
+        prints.resize( frags.list.size() );
+
+        for ( i = 0; i < frags.list.size(); ++i ) {
+            const filter::fragment_t & frag = frags.list[i];
+
+            prints[i] = fingerprint( bases( reads[frag.read], frags, frag ), frag.to - frag.from, frag.sample );
+        }
+    }
+
+    // dedup_t ------------------------------------------------------------------------------------------------------ //
+
+    dedup_t::dedup_t( const size_t cap, const bool derep ) :
+        cap( cap ),
+        derep( derep ),
+        slots( DEDUP_MIN_SLOTS, 0 ),
+        shift( 64 ),
+        nslot_used( 0 ),
+        nunique( 0L ),
+        nduplicate( 0L ),
+        nlate( 0L )
+    {
+        size_t n;
+
+        for ( n = 1; n < slots.size(); n <<= 1 )
+            shift -= 1;
+
+        if ( derep )
+            indices.assign( slots.size(), 0 );
+
+        if ( exact_bytes() > cap / 2 )
+            freeze();
+    }
+
+    size_t dedup_t::exact_bytes() const
+    {
+        return slots.size() * sizeof( uint64_t )
+             + indices.size() * sizeof( size_t )
+             + uniques_.capacity() * sizeof( unique_t )
+             + store.size();
+    }
+
+    // the slot of fingerprint, or the empty slot it would go in
+    size_t dedup_t::find( const uint64_t print ) const
+    {
+        size_t i;
+
+        for ( i = print >> shift; slots[i] && slots[i] != print; i = ( i + 1 ) & ( slots.size() - 1 ) ) ;
+
+        return i;
+    }
+
+    // double the table, unless that would take it over half the cap
+    void dedup_t::grow()
+    {
+        std::vector<uint64_t> old_slots;
+        std::vector<size_t> old_indices;
+        size_t i, j;
+
+        if ( exact_bytes() + slots.size() * ( sizeof( uint64_t ) + ( derep ? sizeof( size_t ) : 0 ) ) > cap / 2 ) {
+            freeze();
+            return;
+        }
+
+        old_slots.swap( slots );
+        old_indices.swap( indices );
+        slots.assign( 2 * old_slots.size(), 0 );
+        shift -= 1;
+
+        if ( derep )
+            indices.assign( slots.size(), 0 );
+
+        for ( i = 0; i < old_slots.size(); ++i ) {
+            if ( !old_slots[i] )
+                continue;
+
+            j = find( old_slots[i] );
+            slots[j] = old_slots[i];
+
+            if ( derep )
+                indices[j] = old_indices[i];
+        }
+    }
+
+    // fingerprints in the table are still found there,
+    // and the rest go to a Bloom filter of the other half of the cap
+    void dedup_t::freeze()
+    {
+        const size_t block = DEDUP_BLOCK_WORDS * sizeof( uint64_t ),
+                     nblock = ( cap / 2 > block ) ? ( cap / 2 ) / block : 1;
+
+        bloom.assign( nblock * DEDUP_BLOCK_WORDS, 0 );
+    }
+
+    // set the fingerprint's bits, all in one block, and
+    // whether they were all set already: probably seen before
+    bool dedup_t::bloom_insert( const uint64_t print )
+    {
+        const size_t nblock = bloom.size() / DEDUP_BLOCK_WORDS;
+        uint64_t * const block = &bloom[( ( print * UINT64_C( 0x9e3779b97f4a7c15 ) ) >> 24 ) % nblock * DEDUP_BLOCK_WORDS];
+        bool seen = true;
+        unsigned k;
+
+        // each bit from 9 bits of the fingerprint: 3 for the word and 6 for the bit
+        for ( k = 0; k < DEDUP_BLOOM_BITS; ++k ) {
+            const unsigned pos = unsigned( print >> ( 9 * k ) ) & 0x1ff;
+            const uint64_t bit = UINT64_C( 1 ) << ( pos & 63 );
+
+            if ( !( block[pos >> 6] & bit ) ) {
+                block[pos >> 6] |= bit;
+                seen = false;
+            }
+        }
+
+        return seen;
+    }
+
+    // whether the fragment is new, recording it if it is
+    bool dedup_t::insert( const seq::seq_t & seq, const filter::fragments_t & frags, const filter::fragment_t & frag, const uint64_t print )
+    {
+        const size_t i = find( print );
+
+        if ( slots[i] == print ) {
+            if ( derep )
+                uniques_[indices[i]].size += 1;
+
+            return false;
+        }
+
+        if ( approximate() ) {
+            if ( bloom_insert( print ) )
+                return false;
+
+            nunique += 1;
+            nlate += 1;
+
+            return true;
+        }
+
+        slots[i] = print;
+        nslot_used += 1;
+        nunique += 1;
+
+        if ( derep ) {
+            unique_t unique;
+
+            // IDs are views of their lines, not strings
+            for ( unique.idlen = 0; unique.idlen < seq.id.length(); ++unique.idlen )
+                if ( seq.id[unique.idlen] == ' ' || seq.id[unique.idlen] == '\t' )
+                    break;
+
+            unique.offset = store.size();
+            unique.len = frag.to - frag.from;
+            unique.size = 1;
+
+            store.append( seq.id.data(), unique.idlen );
+            store.append( bases( seq, frags, frag ), unique.len );
+
+            indices[i] = uniques_.size();
+            uniques_.push_back( unique );
+        }
+
+        // keep the table at most half full
+        if ( 2 * nslot_used > slots.size() )
+            grow();
+        else if ( exact_bytes() > cap / 2 )
+            freeze();
+
+        return true;
+    }
+
+    void dedup_t::filter( const seq::seq_t * reads, filter::fragments_t & frags, const std::vector<uint64_t> & prints )
+    {
+        size_t i,
+               n = 0;
+
+        for ( i = 0; i < frags.list.size(); ++i ) {
+            const filter::fragment_t & frag = frags.list[i];
+
+            if ( insert( reads[frag.read], frags, frag, prints[i] ) )
+                frags.list[n++] = frag;
+            else
+                nduplicate += 1;
+        }
+
+        frags.list.erase( frags.list.begin() + n, frags.list.end() );
+    }
+
+    // the most abundant first, and of equally abundant, the first seen
+    class by_size_t
+    {
+    private:
+        const std::vector<long> & sizes;
+
+    public:
+        by_size_t( const std::vector<long> & sizes ) :
+            sizes( sizes )
+        {
+        }
+
+        bool operator()( const size_t a, const size_t b ) const {
+            return sizes[a] > sizes[b];
+        }
+    };
+
+    void dedup_t::write( const ofile::writer_t & writer, ofile::ofile_t & file ) const
+    {
+        std::vector<size_t> order( uniques_.size() );
+        std::vector<long> sizes( uniques_.size() );
+        ofile::buffer_t out;
+        char size[32];
+        size_t i;
+
+        for ( i = 0; i < uniques_.size(); ++i ) {
+            order[i] = i;
+            sizes[i] = uniques_[i].size;
+        }
+
+        std::stable_sort( order.begin(), order.end(), by_size_t( sizes ) );
+
+        for ( i = 0; i < order.size(); ++i ) {
+            const unique_t & unique = uniques_[order[i]];
+            const int n = snprintf( size, sizeof( size ), ";size=%ld", unique.size );
+
+            out.put( '>' );
+            out.append( store.data() + unique.offset, unique.idlen );
+            out.append( size, n );
+            out.put( '\n' );
+            writer.sequence<false>( out, store.data() + unique.offset + unique.idlen, unique.len );
+
+            if ( out.size() >= OBUF_SZ ) {
+                file.write( out );
+                out.clear();
+            }
+        }
+
+        file.write( out );
+    }
+}
@@ -0,0 +1,93 @@
+
+#ifndef DEDUP_H
+#define DEDUP_H
+
+#include <cstddef>
+#include <stdint.h>
+#include <vector>
+
+#include "filter.hpp"
+#include "ofile.hpp"
+#include "seq.hpp"
+
+// the smallest fingerprint table, in slots
+#define DEDUP_MIN_SLOTS 1024
+// 64-bit words in a Bloom filter block (a cache line),
+// and the bits each fingerprint sets in its block
+#define DEDUP_BLOCK_WORDS 8
+#define DEDUP_BLOOM_BITS 4
+
+// duplicate fragment removal: the bases of each fragment are reduced to a
+// 64-bit fingerprint, alongside filtering, and the fingerprints are then
+// looked up in input order in an open-addressing table, so the first of
+// each run of duplicates is the one kept. Once the table (and with
+// dereplication, the unique fragments) would take more than half the memory
+// cap, it is frozen, and fingerprints not in it go to a blocked Bloom filter
+// of the other half instead: fragments it has probably seen are dropped,
+// which now and then drops a unique fragment too
+namespace dedup
+{
+    // a fingerprint of n bases, never 0, which marks an empty slot;
+    // the same bases with a different seed make a different fingerprint
+    uint64_t fingerprint( const char *, const size_t n, const uint64_t seed=0 );
+
+    // the fingerprints of a batch's fragments, in frags.list order, seeded
+    // with each fragment's sample, so duplicates are only those within a sample
+    void fingerprints( const seq::seq_t *, const filter::fragments_t &, std::vector<uint64_t> & );
+
+    class dedup_t
+    {
+    private:
+        // a fragment kept for dereplication: its first ID word and bases in store
+        class unique_t
+        {
+        public:
+            size_t offset;
+            size_t idlen;
+            size_t len;
+            long size;
+        };
+
+        const size_t cap;
+        const bool derep;
+        std::vector<uint64_t> slots;
+        // with derep, the unique_t of each slot
+        std::vector<size_t> indices;
+        unsigned shift;
+        size_t nslot_used;
+        std::vector<unique_t> uniques_;
+        ofile::buffer_t store;
+        // empty until the table is frozen
+        std::vector<uint64_t> bloom;
+        long nunique;
+        long nduplicate;
+        // unique fragments first seen after the table was frozen,
+        // which are in no dereplicated output
+        long nlate;
+
+        dedup_t( const dedup_t & );
+        dedup_t & operator=( const dedup_t & );
+
+        size_t exact_bytes() const;
+        size_t find( const uint64_t ) const;
+        void grow();
+        void freeze();
+        bool bloom_insert( const uint64_t );
+        bool insert( const seq::seq_t &, const filter::fragments_t &, const filter::fragment_t &, const uint64_t );
+
+    public:
+        // cap in bytes; derep to keep each unique fragment, and count its duplicates
+        dedup_t( const size_t cap, const bool derep );
+        // drop from frags the fragments seen before, in this batch or an earlier one
+        void filter( const seq::seq_t *, filter::fragments_t &, const std::vector<uint64_t> & );
+        // the unique fragments, most abundant first, as FASTA ">ID;size=N" records
+        void write( const ofile::writer_t &, ofile::ofile_t & ) const;
+
+        inline long uniques() const { return nunique; }
+        inline long duplicates() const { return nduplicate; }
+        inline long late() const { return nlate; }
+        inline bool approximate() const { return !bloom.empty(); }
+    };
+}
+
+#endif // DEDUP_H
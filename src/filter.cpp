@@ -0,0 +1,555 @@
+
+#include <cctype>
+#include <cstring>
+
+#include "filter.hpp"
+#include "qscan.hpp"
+
+namespace filter
+{
+    const size_t fragment_t::npos;
+
+    settings_t::settings_t() :
+        min_length( DEFAULT_MIN_LENGTH ),
+        min_qscore( DEFAULT_MIN_QSCORE ),
+        split( false ),
+        hpoly( false ),
+        ambig( false ),
+        window( 0 ),
+        punch( '\0' ),
+        remove_count( DEFAULT_REMOVE_COUNT ),
+        tag_mismatch( DEFAULT_TAG_MISMATCH ),
+        tag_window( 0 ),
+        defer_count( false )
+    {
+    }
+
+    settings_t::settings_t( const argparse::args_t & args ) :
+        min_length( args.min_length ),
+        min_qscore( args.min_qscore ),
+        split( args.split ),
+        hpoly( args.hpoly ),
+        ambig( args.ambig ),
+        window( args.window ),
+        punch( args.punch ),
+        remove_count( args.remove_count ),
+        tag( args.tag, args.tag_length ),
+        tag_mismatch( args.tag_mismatch ),
+        tag_window( args.tag_window ),
+        barcodes( args.barcodes ),
+        defer_count( args.dedup || args.mates != NULL )
+    {
+    }
+
+    counts_t::counts_t() :
+        total_bases( 0L ),
+        q_over10( 0L ),
+        q_over20( 0L ),
+        q_over30( 0L ),
+        q_score_sum( 0.0 ),
+        ncontrib( 0L ),
+        unassigned( 0L ),
+        ambiguous( 0L ),
+        pairs( 0L ),
+        both_mates( 0L ),
+        one_mate( 0L )
+    {
+    }
+
+    void counts_t::merge( const counts_t & other )
+    {
+        total_bases += other.total_bases;
+        q_over10 += other.q_over10;
+        q_over20 += other.q_over20;
+        q_over30 += other.q_over30;
+        // quality scores are integers, so this sum is exact in any order
+        q_score_sum += other.q_score_sum;
+        ncontrib += other.ncontrib;
+        read_lengths.merge( other.read_lengths );
+        fragment_lengths.merge( other.fragment_lengths );
+
+        // with dedup, fragments are counted apart from reads,
+        // so either may have seen samples the other hasn't
+        if ( sample_reads.size() < other.sample_reads.size() )
+            sample_reads.resize( other.sample_reads.size(), 0L );
+
+        if ( sample_fragments.size() < other.sample_fragments.size() )
+            sample_fragments.resize( other.sample_fragments.size(), 0L );
+
+        for ( size_t i = 0; i < other.sample_reads.size(); ++i )
+            sample_reads[i] += other.sample_reads[i];
+
+        for ( size_t i = 0; i < other.sample_fragments.size(); ++i )
+            sample_fragments[i] += other.sample_fragments[i];
+
+        unassigned += other.unassigned;
+        ambiguous += other.ambiguous;
+        pairs += other.pairs;
+        both_mates += other.both_mates;
+        one_mate += other.one_mate;
+    }
+
+    filter_t::filter_t( const settings_t & settings ) :
+        settings( settings ),
+        tag( settings.tag ),
+        // only searched with -e, which argparse limits to TAG_SEARCH_BASES
+        search( settings.tag_window ? settings.tag : std::string() ),
+        barcodes( settings.barcodes, settings.tag_mismatch ),
+        kernel( select( settings ) )
+    {
+    }
+
+    filter_t::kernel_t filter_t::select( const settings_t & settings )
+    {
+        if ( settings.punch )
+            return &filter_t::filter_reads<MODE_PUNCH>;
+
+        if ( settings.window )
+            return settings.split
+                ? &filter_t::filter_reads<MODE_WINDOW | MODE_SPLIT>
+                : &filter_t::filter_reads<MODE_WINDOW>;
+
+        switch ( ( settings.split ? MODE_SPLIT : 0 ) | ( settings.hpoly ? MODE_HPOLY : 0 ) | ( settings.ambig ? MODE_AMBIG : 0 ) ) {
+        case 0:
+            return &filter_t::filter_reads<0>;
+        case MODE_SPLIT:
+            return &filter_t::filter_reads<MODE_SPLIT>;
+        case MODE_HPOLY:
+            return &filter_t::filter_reads<MODE_HPOLY>;
+        case MODE_SPLIT | MODE_HPOLY:
+            return &filter_t::filter_reads<MODE_SPLIT | MODE_HPOLY>;
+        case MODE_AMBIG:
+            return &filter_t::filter_reads<MODE_AMBIG>;
+        case MODE_SPLIT | MODE_AMBIG:
+            return &filter_t::filter_reads<MODE_SPLIT | MODE_AMBIG>;
+        case MODE_HPOLY | MODE_AMBIG:
+            return &filter_t::filter_reads<MODE_HPOLY | MODE_AMBIG>;
+        default:
+            return &filter_t::filter_reads<MODE_SPLIT | MODE_HPOLY | MODE_AMBIG>;
+        }
+    }
+
+    // gather read stats
+    void filter_t::tally( const seq::seq_t & seq, counts_t & counts ) const
+    {
+        qscan::totals_t tot;
+
+        if ( seq.length == 0 )
+            return;
+
+        counts.read_lengths.add( seq.length );
+        counts.total_bases += seq.length;
+
+        qscan::tally( seq.quals.data(), seq.length, tot, seq.offset );
+
+        counts.q_score_sum += tot.sum;
+        counts.q_over10 += tot.over10;
+        counts.q_over20 += tot.over20;
+        counts.q_over30 += tot.over30;
+    }
+
+    // MODE is fixed at compile time, so each instance carries only its own mode's tests
+    template <unsigned MODE>
+    void filter_t::fragments( const seq::seq_t & seq, const size_t read, counts_t & counts, fragments_t & frags ) const
+    {
+        if ( seq.length == 0 || seq.length < settings.min_length )
+            return;
+
+        // maxto is the maximum value of "to",
+        // NOT THE UPPER BOUND
+        const size_t maxto = seq.length - settings.min_length;
+        // scores are compared raw, the thresholds moved up by off
+        const unsigned char * const q = seq.quals.data();
+        const char * const bases = seq.seq.data();
+        const unsigned char off = seq.offset;
+        fragment_t frag;
+        size_t nfragment = 0,
+               to = 0;
+
+        frag.sample = 0;
+
+        // compare the sequence prefix to the tag,
+        // if it matches by at least tag_mismatch,
+        // keep the sequence, otherwise discard
+        // (or search the first tag_window bases for it, with edits,
+        // and strip through the end of the best match)
+        if ( tag.length() && settings.tag_window ) {
+            to = search.find( bases, ( seq.length < settings.tag_window ) ? seq.length : settings.tag_window, settings.tag_mismatch );
+
+            if ( to == tag::searcher_t::npos || to > maxto )
+                return;
+        }
+        else if ( tag.length() ) {
+            if ( maxto < tag.length() )
+                return;
+
+            if ( tag.mismatches( bases, settings.tag_mismatch ) > settings.tag_mismatch )
+                return;
+
+            to = tag.length();
+        }
+        // or find the read's sample by its barcode
+        else if ( barcodes.size() ) {
+            if ( maxto < barcodes.length() )
+                return;
+
+            frag.sample = barcodes.find( bases );
+
+            if ( frag.sample == tag::index_t::none ) {
+                counts.unassigned += 1;
+                return;
+            }
+            else if ( frag.sample == tag::index_t::ambiguous ) {
+                counts.ambiguous += 1;
+                return;
+            }
+
+            if ( counts.sample_reads.size() < barcodes.size() )
+                counts.sample_reads.resize( barcodes.size(), 0L );
+
+            counts.sample_reads[frag.sample] += 1;
+            to = barcodes.length();
+        }
+
+        frag.read = read;
+        frag.bases = fragment_t::npos;
+
+        if ( MODE & MODE_PUNCH ) {
+            const size_t mark = frags.bases.size();
+            unsigned long nambigs = 0UL;
+
+            frag.number = 0;
+            frag.from = to;
+            frag.bases = mark;
+
+            // copy each run of good bases whole, punching out the bad one that ends it
+            while ( to < seq.length ) {
+                const size_t bad = qscan::find_below( q, to, seq.length, settings.min_qscore, off );
+
+                frags.bases.append( bases + to, bad - to );
+                to = bad;
+
+                if ( to == seq.length )
+                    break;
+
+                frags.bases.put( settings.punch );
+                nambigs++;
+                if ( nambigs >= settings.remove_count ) {
+                    break;
+                }
+
+                to += 1;
+            }
+
+            // too many low quality bases, take the read back out
+            if ( to < seq.length ) {
+                frags.bases.resize( mark );
+                return;
+            }
+
+            frag.to = to;
+            frag.length = to - frag.from;
+            frags.list.push_back( frag );
+        }
+        // with sliding windows, a fragment runs from the first window whose mean score
+        // meets the minimum to the first window after it that doesn't, less any
+        // low quality bases at either end; split and truncate work as below
+        else if ( MODE & MODE_WINDOW ) {
+            // a read shorter than a window is a window of its own
+            const size_t w = ( seq.length < settings.window ) ? seq.length : settings.window,
+                         // one past the start of the last window
+                         last = seq.length - w + 1;
+
+            while ( to < last ) {
+                size_t from = qscan::find_window_at_least( q, to, last, w, settings.min_qscore, off ),
+                       end;
+
+                if ( from == last )
+                    break;
+
+                to = qscan::find_window_below( q, from + 1, last, w, settings.min_qscore, off );
+                end = ( to == last ) ? seq.length : to;
+
+                from = qscan::find_at_least( q, from, end, settings.min_qscore, off );
+
+                while ( end > from && seq.quality( end - 1 ) < settings.min_qscore )
+                    --end;
+
+                if ( end - from < settings.min_length )
+                    continue;
+
+                frag.number = nfragment;
+                frag.from = from;
+                frag.to = end;
+                frag.length = end - from;
+                frags.list.push_back( frag );
+
+                if ( !( MODE & MODE_SPLIT ) )
+                    break;
+
+                nfragment += 1;
+            }
+        }
+        // if we're splitting,
+        // continue the following process until we reach the end of the sequence,
+        // but only continue if there's enough left to produce a minimum-sized fragment
+        else while ( true ) {
+            size_t from = 0,
+                   nambigs = 0;
+
+            // push through the sequence until the quality score meets the minimum
+            to = qscan::find_at_least( q, to, maxto + 1, settings.min_qscore, off );
+
+            // if we don't have enough length left,
+            // skip to the next sequence
+            if ( to > maxto )
+                break;
+
+            // begin with positive quality score
+            from = to;
+
+            // build a read until we hit a low quality score,
+            // that is, unless we're skipping Ns or retaining homopolymers
+            for ( ; ( to = qscan::find_below( q, to, seq.length, settings.min_qscore, off ) ) < seq.length; ++to ) {
+                char curr = bases[to],
+                     last = -1;
+
+                // with neither, the first low quality score ends the fragment
+                if ( !( MODE & ( MODE_HPOLY | MODE_AMBIG ) ) )
+                    break;
+                // if homopolymer (toupper -> case insensitive), continue (last == curr)
+                else if ( ( MODE & MODE_HPOLY ) && toupper( last ) == toupper( curr ) )
+                    continue;
+                // if skipping Ns, continue (without assigning last)
+                else if ( ( MODE & MODE_AMBIG ) && ( curr == 'N' || curr == 'n' ) ) {
+                    nambigs += 1;
+                    continue;
+                }
+                // otherwise, ABORT!!!
+                else
+                    break;
+            }
+
+            // "to" is now the upper bound
+
+            // if our fragment isn't long enough,
+            // skip to the next fragment
+            if ( to - from - nambigs < settings.min_length )
+                continue;
+
+            frag.number = nfragment;
+            frag.from = from;
+            frag.to = to;
+            frag.length = to - from - nambigs;
+            frags.list.push_back( frag );
+
+            if ( !( MODE & MODE_SPLIT ) )
+                break;
+
+            // only increment fragment identifier after printing
+            nfragment += 1;
+        }
+    }
+
+    template <unsigned MODE>
+    void filter_t::filter_reads( const seq::seq_t * reads, const size_t n, const size_t read, counts_t & counts, fragments_t & frags ) const
+    {
+        size_t i;
+
+        for ( i = 0; i < n; ++i )
+            fragments<MODE>( reads[i], read + i, counts, frags );
+    }
+
+    void filter_t::operator()( const seq::seq_t & seq, const size_t read, counts_t & counts, fragments_t & frags ) const
+    {
+        const size_t from = frags.list.size();
+
+        tally( seq, counts );
+        ( this->*kernel )( &seq, 1, read, counts, frags );
+
+        if ( !settings.defer_count )
+            count( frags, from, counts );
+    }
+
+    void filter_t::filter_batch( const seq::seq_t * reads, const size_t n, counts_t & counts, fragments_t & frags, profile::times_t * times ) const
+    {
+        const size_t from = frags.list.size();
+        size_t i;
+
+        {
+            profile::scope_t scope( times, profile::STATS );
+
+            for ( i = 0; i < n; ++i )
+                tally( reads[i], counts );
+        }
+
+        {
+            profile::scope_t scope( times, profile::FILTER );
+
+            ( this->*kernel )( reads, n, 0, counts, frags );
+        }
+
+        if ( !settings.defer_count ) {
+            profile::scope_t scope( times, profile::STATS );
+            count( frags, from, counts );
+        }
+    }
+
+    // a read's fragments are listed together, so it contributes
+    // if any of them is listed, by the first
+    void filter_t::count( const fragments_t & frags, const size_t from, counts_t & counts ) const
+    {
+        size_t i;
+
+        if ( barcodes.size() && counts.sample_fragments.size() < barcodes.size() )
+            counts.sample_fragments.resize( barcodes.size(), 0L );
+
+        for ( i = from; i < frags.list.size(); ++i ) {
+            const fragment_t & frag = frags.list[i];
+
+            if ( i == from || frag.read != frags.list[i - 1].read )
+                counts.ncontrib += 1;
+
+            counts.fragment_lengths.add( frag.length );
+
+            if ( barcodes.size() )
+                counts.sample_fragments[frag.sample] += 1;
+        }
+    }
+
+    template <bool FASTQ>
+    static inline
+    void format_record( const ofile::writer_t & writer, const seq::seq_t & seq, const fragments_t & frags, const fragment_t & frag, ofile::buffer_t & out )
+    {
+        const size_t len = frag.to - frag.from;
+
+        writer.header<FASTQ>( out, seq.id.data(), seq.id.length(), frag.number );
+
+        // punched reads are written on a single line
+        if ( frag.bases != fragment_t::npos )
+            writer.sequence<FASTQ>( out, frags.bases.data() + frag.bases, len, false );
+        else
+            writer.sequence<FASTQ>( out, seq.seq.data() + frag.from, len );
+
+        writer.qualities<FASTQ>( out, seq.quals.data() + frag.from, len, seq.offset );
+    }
+
+    template <bool FASTQ>
+    static void format_records( const ofile::writer_t & writer, const seq::seq_t * reads, const fragments_t & frags, ofile::buffer_t * outs )
+    {
+        size_t i;
+
+        for ( i = 0; i < frags.list.size(); ++i ) {
+            const fragment_t & frag = frags.list[i];
+
+            format_record<FASTQ>( writer, reads[frag.read], frags, frag, outs[frag.sample] );
+        }
+    }
+
+    // a record of a mate written, as a contributing read and a retained fragment
+    static inline
+    void count_mate( const fragment_t & frag, counts_t & counts )
+    {
+        counts.ncontrib += 1;
+        counts.fragment_lengths.add( frag.length );
+    }
+
+    template <bool FASTQ>
+    static void format_mates(
+        const ofile::writer_t & writer,
+        const argparse::pairing_t pairing,
+        const bool tagged,
+        const seq::seq_t * reads,
+        const fragments_t & frags,
+        const seq::seq_t * mates,
+        const fragments_t & mate_frags,
+        const size_t n,
+        ofile::buffer_t * outs,
+        counts_t & counts
+        )
+    {
+        fragment_t whole;
+        size_t i,
+               j = 0,
+               k = 0;
+
+        whole.number = 0;
+        whole.from = 0;
+        whole.bases = fragment_t::npos;
+
+        for ( i = 0; i < n; ++i ) {
+            const fragment_t * const first = ( j < frags.list.size() && frags.list[j].read == i ) ? &frags.list[j++] : NULL,
+                             * const second = ( k < mate_frags.list.size() && mate_frags.list[k].read == i ) ? &mate_frags.list[k++] : NULL;
+
+            counts.pairs += 1;
+
+            if ( first && second ) {
+                counts.both_mates += 1;
+                format_record<FASTQ>( writer, reads[i], frags, *first, outs[0] );
+                format_record<FASTQ>( writer, mates[i], mate_frags, *second, outs[1] );
+                count_mate( *first, counts );
+                count_mate( *second, counts );
+                continue;
+            }
+            else if ( !first && !second )
+                continue;
+
+            counts.one_mate += 1;
+
+            if ( pairing == argparse::PAIR ) {
+                // a mate skipped as malformed has no record to write whole,
+                // so the pair is dropped
+                if ( !( first ? mates[i] : reads[i] ).length )
+                    continue;
+
+                // nor has a first mate whose tag may not even be there
+                // to strip, so that no R1 record goes out with one
+                if ( tagged && !first )
+                    continue;
+
+                whole.read = i;
+                whole.to = ( first ? mates[i] : reads[i] ).length;
+                whole.length = whole.to;
+                format_record<FASTQ>( writer, reads[i], frags, first ? *first : whole, outs[0] );
+                format_record<FASTQ>( writer, mates[i], mate_frags, second ? *second : whole, outs[1] );
+                count_mate( first ? *first : whole, counts );
+                count_mate( second ? *second : whole, counts );
+            }
+            else if ( pairing == argparse::ORPHAN ) {
+                if ( first )
+                    format_record<FASTQ>( writer, reads[i], frags, *first, outs[2] );
+                else
+                    format_record<FASTQ>( writer, mates[i], mate_frags, *second, outs[2] );
+
+                count_mate( first ? *first : *second, counts );
+            }
+        }
+    }
+
+    void format( const ofile::writer_t & writer, const seq::seq_t * reads, const fragments_t & frags, ofile::buffer_t * outs )
+    {
+        if ( writer.fastq() )
+            format_records<true>( writer, reads, frags, outs );
+        else
+            format_records<false>( writer, reads, frags, outs );
+    }
+
+    void format_pairs(
+        const ofile::writer_t & writer,
+        const argparse::pairing_t pairing,
+        const bool tagged,
+        const seq::seq_t * reads,
+        const fragments_t & frags,
+        const seq::seq_t * mates,
+        const fragments_t & mate_frags,
+        const size_t n,
+        ofile::buffer_t * outs,
+        counts_t & counts
+        )
+    {
+        if ( writer.fastq() )
+            format_mates<true>( writer, pairing, tagged, reads, frags, mates, mate_frags, n, outs, counts );
+        else
+            format_mates<false>( writer, pairing, tagged, reads, frags, mates, mate_frags, n, outs, counts );
+    }
+}
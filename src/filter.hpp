@@ -0,0 +1,180 @@
+
+#ifndef FILTER_H
+#define FILTER_H
+
+#include <string>
+#include <vector>
+
+#include "argparse.hpp"
+#include "ofile.hpp"
+#include "profile.hpp"
+#include "seq.hpp"
+#include "stats.hpp"
+#include "tag.hpp"
+
+namespace filter
+{
+    // filter settings, independent of the command line
+    class settings_t
+    {
+    public:
+        size_t min_length;
+        size_t min_qscore;
+        bool split; // split not truncate
+        bool hpoly; // tolerate homopolymers
+        bool ambig; // tolerate ambigs ('N')
+        size_t window; // sliding window width, 0 for per-base
+        char punch;
+        unsigned long remove_count;
+        std::string tag;
+        size_t tag_mismatch;
+        // search for the tag within this many bases, with edits, 0 for a prefix match
+        size_t tag_window;
+        // for demultiplexing, each sample's barcode, in place of a single tag
+        std::vector<std::string> barcodes;
+        // retained fragments are counted by the caller, once it knows which
+        // are written: with count() once duplicates are dropped, or by
+        // format_pairs() once the pairing policy has been applied
+        bool defer_count;
+
+        settings_t();
+        settings_t( const argparse::args_t & );
+    };
+
+    // run counters, kept per thread and merged at the end of a run
+    class counts_t
+    {
+    public:
+        long total_bases;
+        long q_over10;
+        long q_over20;
+        long q_over30;
+        double q_score_sum;
+        long ncontrib;
+        stats::lengths_t read_lengths;
+        stats::lengths_t fragment_lengths;
+        // when demultiplexing, the reads assigned to each sample
+        // and the fragments retained from them, grown as samples are seen,
+        // and the reads with no barcode, or more than one, nearest
+        std::vector<long> sample_reads;
+        std::vector<long> sample_fragments;
+        long unassigned;
+        long ambiguous;
+        // for paired-end reads, the pairs, and those with fragments
+        // retained from both mates, and from only one
+        long pairs;
+        long both_mates;
+        long one_mate;
+
+        counts_t();
+        void merge( const counts_t & );
+    };
+
+    // a retained fragment: bases [from, to) of a read
+    class fragment_t
+    {
+    public:
+        // index of the read in the batch
+        size_t read;
+        // 0 for the first fragment of a read, 1 for the second, ...
+        size_t number;
+        size_t from;
+        size_t to;
+        // the fragment length less any tolerated ambigs
+        size_t length;
+        // the read's sample, when demultiplexing, and its output
+        size_t sample;
+        // for punch mode, offset of the punched bases in fragments_t::bases,
+        // otherwise npos: the bases are the read's own
+        size_t bases;
+
+        static const size_t npos = size_t( -1 );
+    };
+
+    // caller-owned fragment storage, reused from batch to batch
+    class fragments_t
+    {
+    public:
+        std::vector<fragment_t> list;
+        ofile::buffer_t bases;
+
+        inline
+        void clear() {
+            list.clear();
+            bases.clear();
+        }
+    };
+
+    // the filter kernel bits: the -m mode (SPLIT, HPOLY, AMBIG),
+    // or PUNCH, or WINDOW (with or without SPLIT)
+    enum mode_t {
+        MODE_SPLIT = 1,
+        MODE_HPOLY = 2,
+        MODE_AMBIG = 4,
+        MODE_PUNCH = 8,
+        MODE_WINDOW = 16
+    };
+
+    // the filtering engine: gathers read stats, checks the tag,
+    // and finds the fragments to retain in each read
+    class filter_t
+    {
+    private:
+        // filters n reads, the first of them numbered read
+        typedef void ( filter_t::*kernel_t )( const seq::seq_t *, const size_t n, const size_t read, counts_t &, fragments_t & ) const;
+
+        const settings_t settings;
+        const tag::matcher_t tag;
+        // the tag again, for searching with edits
+        const tag::searcher_t search;
+        const tag::index_t barcodes;
+        // the kernel for the settings' mode, chosen once, up front
+        const kernel_t kernel;
+
+        static kernel_t select( const settings_t & );
+
+        void tally( const seq::seq_t &, counts_t & ) const;
+        template <unsigned MODE>
+        void fragments( const seq::seq_t &, const size_t, counts_t &, fragments_t & ) const;
+        template <unsigned MODE>
+        void filter_reads( const seq::seq_t *, const size_t, const size_t, counts_t &, fragments_t & ) const;
+
+    public:
+        filter_t( const settings_t & );
+        // filter a single read, its fragments referring to it as read
+        void operator()( const seq::seq_t &, const size_t read, counts_t &, fragments_t & ) const;
+        // filter n reads, appending their fragments to frags,
+        // and charging the time spent to times, if given
+        void filter_batch( const seq::seq_t *, const size_t n, counts_t &, fragments_t &, profile::times_t * times=NULL ) const;
+        // count the retained fragments from frags.list[from] on,
+        // and the reads they come from; with defer_count, left to the caller
+        void count( const fragments_t &, const size_t from, counts_t & ) const;
+        // whether reads must start with a tag (-T), which is stripped
+        inline bool tagged() const { return tag.length() != 0; }
+    };
+
+    // append each fragment, as a FASTA or FASTQ record, to outs[sample]
+    void format( const ofile::writer_t &, const seq::seq_t *, const fragments_t &, ofile::buffer_t * outs );
+
+    // for n pairs of reads and their mates, at most one fragment each (as
+    // there is no splitting), append the fragments of pairs to outs[0] and
+    // outs[1], and the fragment of a pair with only one as pairing has it:
+    // paired with the other mate whole, to outs[2], or not at all; the
+    // records written, of either mate, are counted as retained fragments.
+    // When tagged, a first mate is never written whole, with its tag still
+    // on it: with pairing PAIR, such a pair is dropped instead
+    void format_pairs(
+        const ofile::writer_t &,
+        const argparse::pairing_t,
+        const bool tagged,
+        const seq::seq_t * reads,
+        const fragments_t &,
+        const seq::seq_t * mates,
+        const fragments_t &,
+        const size_t n,
+        ofile::buffer_t * outs,
+        counts_t &
+        );
+}
+
+#endif // FILTER_H
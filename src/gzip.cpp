@@ -0,0 +1,799 @@
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <condition_variable>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <unistd.h>
+#include <zlib.h>
+
+#include "gzip.hpp"
+
+#define GZ_ERROR( path, msg ) \
+{ \
+    fprintf( stderr, "\nERROR (file: %s): %s\n", path, msg ); \
+    exit( 1 ); \
+}
+
+// gzip member header: magic, method, flags, mtime, xfl, os, then XLEN if FEXTRA
+#define GZ_HDR_SZ 12
+// BGZF header with its BC extra subfield
+#define BGZF_HDR_SZ 18
+// a BGZF block holds at most 64 KiB, compressed or not
+#define BGZF_BLOCK_SZ 65536
+
+namespace gzip
+{
+    // source_t ----------------------------------------------------------------------------------------------------- //
+
+    source_t::source_t( const char * data, size_t len ) :
+        mem( reinterpret_cast<const unsigned char *>( data ) ),
+        mem_len( len ),
+        mem_pos( 0 ),
+        file( NULL )
+    {
+    }
+
+    source_t::source_t( FILE * file ) :
+        mem( NULL ),
+        mem_len( 0 ),
+        mem_pos( 0 ),
+        file( file )
+    {
+    }
+
+    size_t source_t::read( unsigned char * dst, size_t n )
+    {
+        size_t nread = std::min( n, pending.length() );
+
+        memcpy( dst, pending.data(), nread );
+        pending.erase( 0, nread );
+
+        if ( nread == n )
+            return nread;
+
+        if ( mem ) {
+            const size_t nmem = std::min( n - nread, mem_len - mem_pos );
+            memcpy( dst + nread, mem + mem_pos, nmem );
+            mem_pos += nmem;
+            return nread + nmem;
+        }
+
+        return nread + fread( dst + nread, 1, n - nread, file );
+    }
+
+    void source_t::unread( const unsigned char * data, size_t n )
+    {
+        pending.insert( 0, reinterpret_cast<const char *>( data ), n );
+    }
+
+    bool is_gzip( const unsigned char * data, size_t len )
+    {
+        return len >= 2 && data[0] == 0x1f && data[1] == 0x8b;
+    }
+
+    static
+    bool is_bgzf( const unsigned char * hdr, size_t len )
+    {
+        return len >= BGZF_HDR_SZ
+            && is_gzip( hdr, len )
+            && hdr[2] == 8         // deflate
+            && ( hdr[3] & 4 )      // FEXTRA
+            && hdr[12] == 'B'
+            && hdr[13] == 'C'
+            && hdr[14] == 2
+            && hdr[15] == 0;
+    }
+
+    // stream_t: plain gzip ----------------------------------------------------------------------------------------- //
+
+    class chunk_t
+    {
+    public:
+        std::vector<char> data;
+        size_t len;
+
+        chunk_t() :
+            data( GZ_CHUNK_SZ ),
+            len( 0 )
+        {
+        }
+    };
+
+    // inflates a (possibly multi-member) gzip stream on a read-ahead thread,
+    // so decompression of the next chunks overlaps with parsing of this one
+    class stream_t : public inflater_t
+    {
+    private:
+        static const size_t nchunk = 4;
+
+        const char * const path;
+        source_t * const source;
+        chunk_t chunks[nchunk];
+        queue_t<chunk_t *> free_q;
+        queue_t<chunk_t *> full_q;
+        chunk_t * curr;
+        std::thread thread;
+
+        void run()
+        {
+            std::vector<unsigned char> in( GZ_CHUNK_SZ );
+            chunk_t * chunk = NULL;
+            z_stream z;
+            bool eof = false;
+            int ret = Z_OK;
+
+            memset( &z, 0, sizeof( z ) );
+
+            // 15 + 32: a gzip or zlib header, detected automatically
+            if ( inflateInit2( &z, 15 + 32 ) != Z_OK )
+                GZ_ERROR( path, "failed to initialize zlib" );
+
+            while ( ret != Z_STREAM_END || z.avail_in || !eof ) {
+                if ( !free_q.pop( chunk ) )
+                    break;
+
+                z.next_out = reinterpret_cast<Bytef *>( &chunk->data[0] );
+                z.avail_out = chunk->data.size();
+
+                while ( z.avail_out ) {
+                    if ( !z.avail_in && !eof ) {
+                        z.next_in = &in[0];
+                        z.avail_in = source->read( &in[0], in.size() );
+                        eof = z.avail_in < in.size();
+                    }
+
+                    if ( ret == Z_STREAM_END ) {
+                        // concatenated members decompress to the concatenated data
+                        if ( !z.avail_in && eof )
+                            break;
+
+                        inflateReset( &z );
+                    }
+
+                    ret = inflate( &z, Z_NO_FLUSH );
+
+                    if ( ret == Z_STREAM_END )
+                        continue;
+
+                    if ( ret != Z_OK && !( ret == Z_BUF_ERROR && z.avail_in == 0 && !eof ) )
+                        GZ_ERROR( path, ( ret == Z_BUF_ERROR ) ? "unexpected end of gzip data" : "corrupt gzip data" );
+                }
+
+                chunk->len = chunk->data.size() - z.avail_out;
+
+                if ( !full_q.push( chunk ) )
+                    break;
+            }
+
+            inflateEnd( &z );
+            full_q.close();
+        }
+
+    public:
+        stream_t( const char * path, source_t * source ) :
+            path( path ),
+            source( source ),
+            free_q( nchunk ),
+            full_q( nchunk ),
+            curr( NULL )
+        {
+            size_t i;
+
+            for ( i = 0; i < nchunk; ++i )
+                free_q.push( &chunks[i] );
+
+            thread = std::thread( &stream_t::run, this );
+        }
+
+        ~stream_t()
+        {
+            free_q.close();
+            full_q.close();
+            thread.join();
+            delete source;
+        }
+
+        bool next( const char *& data, size_t & len )
+        {
+            do {
+                if ( curr )
+                    free_q.push( curr );
+
+                curr = NULL;
+
+                if ( !full_q.pop( curr ) )
+                    return false;
+            } while ( !curr->len );
+
+            data = &curr->data[0];
+            len = curr->len;
+
+            return true;
+        }
+    };
+
+    // ahead_t: uncompressed ------------------------------------------------------------------------------------------ //
+
+    // reads uncompressed input into a ring of chunks on a read-ahead thread,
+    // so the next chunks are read while this one is parsed
+    class ahead_t : public inflater_t
+    {
+    private:
+        static const size_t nchunk = 4;
+
+        source_t * const source;
+        chunk_t chunks[nchunk];
+        queue_t<chunk_t *> free_q;
+        queue_t<chunk_t *> full_q;
+        chunk_t * curr;
+        std::thread thread;
+
+        void run()
+        {
+            chunk_t * chunk = NULL;
+
+            while ( free_q.pop( chunk ) ) {
+                chunk->len = source->read( reinterpret_cast<unsigned char *>( &chunk->data[0] ), chunk->data.size() );
+
+                // a short read is the end of the input
+                if ( !full_q.push( chunk ) || chunk->len < chunk->data.size() )
+                    break;
+            }
+
+            full_q.close();
+        }
+
+    public:
+        ahead_t( source_t * source ) :
+            source( source ),
+            free_q( nchunk ),
+            full_q( nchunk ),
+            curr( NULL )
+        {
+            size_t i;
+
+            for ( i = 0; i < nchunk; ++i )
+                free_q.push( &chunks[i] );
+
+            thread = std::thread( &ahead_t::run, this );
+        }
+
+        ~ahead_t()
+        {
+            free_q.close();
+            full_q.close();
+            thread.join();
+            delete source;
+        }
+
+        bool next( const char *& data, size_t & len )
+        {
+            do {
+                if ( curr )
+                    free_q.push( curr );
+
+                curr = NULL;
+
+                if ( !full_q.pop( curr ) )
+                    return false;
+            } while ( !curr->len );
+
+            data = &curr->data[0];
+            len = curr->len;
+
+            return true;
+        }
+    };
+
+    // bgzf_t: block-parallel BGZF ---------------------------------------------------------------------------------- //
+
+    class job_t
+    {
+    public:
+        std::vector<unsigned char> in;
+        // start and end of each block's deflate data within in
+        std::vector<size_t> blocks;
+        std::vector<char> out;
+        size_t len;
+        bool done;
+        std::mutex lock;
+        std::condition_variable finished;
+
+        job_t() :
+            in( BGZF_JOB_BLOCKS * BGZF_BLOCK_SZ ),
+            out( BGZF_JOB_BLOCKS * BGZF_BLOCK_SZ ),
+            len( 0 ),
+            done( false )
+        {
+        }
+    };
+
+    // one thread splits the input into runs of BGZF blocks, a pool inflates
+    // the runs independently, and next() hands them out in input order
+    class bgzf_t : public inflater_t
+    {
+    private:
+        const char * const path;
+        source_t * const source;
+        std::vector<job_t> jobs;
+        queue_t<job_t *> free_q;
+        queue_t<job_t *> work_q;
+        queue_t<job_t *> order_q;
+        job_t * curr;
+        std::thread splitter;
+        std::vector<std::thread> workers;
+
+        // read the next block into job->in, false at the end of input
+        bool read_block( job_t * job, size_t & pos )
+        {
+            unsigned char * hdr = &job->in[pos];
+            size_t xlen, bsize, nread = source->read( hdr, BGZF_HDR_SZ );
+
+            if ( !nread )
+                return false;
+
+            if ( !is_bgzf( hdr, nread ) )
+                GZ_ERROR( path, "malformed BGZF block header" );
+
+            xlen = hdr[10] | ( hdr[11] << 8 );
+            bsize = ( hdr[16] | ( hdr[17] << 8 ) ) + 1;
+
+            if ( bsize < GZ_HDR_SZ + xlen + 8 || bsize > BGZF_BLOCK_SZ )
+                GZ_ERROR( path, "malformed BGZF block size" );
+
+            if ( source->read( hdr + BGZF_HDR_SZ, bsize - BGZF_HDR_SZ ) != bsize - BGZF_HDR_SZ )
+                GZ_ERROR( path, "unexpected end of BGZF data" );
+
+            job->blocks.push_back( pos + GZ_HDR_SZ + xlen );
+            job->blocks.push_back( pos + bsize );
+            pos += bsize;
+
+            return true;
+        }
+
+        void split()
+        {
+            job_t * job = NULL;
+            bool more = true;
+
+            while ( more && free_q.pop( job ) ) {
+                size_t pos = 0;
+
+                job->blocks.clear();
+
+                while ( job->blocks.size() < 2 * BGZF_JOB_BLOCKS ) {
+                    if ( !read_block( job, pos ) ) {
+                        more = false;
+                        break;
+                    }
+                }
+
+                // order first, so next() can wait on the job while it is inflated
+                if ( !order_q.push( job ) || !work_q.push( job ) )
+                    break;
+            }
+
+            order_q.close();
+            work_q.close();
+        }
+
+        void work()
+        {
+            job_t * job = NULL;
+            z_stream z;
+
+            memset( &z, 0, sizeof( z ) );
+
+            // raw deflate: the gzip wrapper of each block is handled here
+            if ( inflateInit2( &z, -15 ) != Z_OK )
+                GZ_ERROR( path, "failed to initialize zlib" );
+
+            while ( work_q.pop( job ) ) {
+                size_t i;
+
+                job->len = 0;
+
+                for ( i = 0; i < job->blocks.size(); i += 2 ) {
+                    const unsigned char * trailer = &job->in[job->blocks[i + 1] - 8];
+                    const unsigned long crc = trailer[0] | ( trailer[1] << 8 ) | ( trailer[2] << 16 ) | ( unsigned long )( trailer[3] ) << 24;
+                    const size_t isize = trailer[4] | ( trailer[5] << 8 ) | ( trailer[6] << 16 ) | ( size_t )( trailer[7] ) << 24;
+                    Bytef * out = reinterpret_cast<Bytef *>( &job->out[job->len] );
+
+                    if ( isize > BGZF_BLOCK_SZ )
+                        GZ_ERROR( path, "malformed BGZF block size" );
+
+                    inflateReset( &z );
+                    z.next_in = &job->in[job->blocks[i]];
+                    z.avail_in = job->blocks[i + 1] - 8 - job->blocks[i];
+                    z.next_out = out;
+                    z.avail_out = isize;
+
+                    if ( ( isize && inflate( &z, Z_FINISH ) != Z_STREAM_END ) || z.avail_out )
+                        GZ_ERROR( path, "corrupt BGZF block" );
+
+                    if ( crc32( crc32( 0L, Z_NULL, 0 ), out, isize ) != crc )
+                        GZ_ERROR( path, "BGZF block checksum mismatch" );
+
+                    job->len += isize;
+                }
+
+                {
+                    std::lock_guard<std::mutex> guard( job->lock );
+                    job->done = true;
+                    job->finished.notify_one();
+                }
+            }
+
+            inflateEnd( &z );
+        }
+
+    public:
+        bgzf_t( const char * path, source_t * source ) :
+            path( path ),
+            source( source ),
+            jobs( 2 * std::min( std::max( std::thread::hardware_concurrency(), 1u ), unsigned( BGZF_THREADS_MAX ) ) + 2 ),
+            free_q( jobs.size() ),
+            work_q( jobs.size() ),
+            order_q( jobs.size() ),
+            curr( NULL )
+        {
+            const size_t nworker = ( jobs.size() - 2 ) / 2;
+            size_t i;
+
+            for ( i = 0; i < jobs.size(); ++i )
+                free_q.push( &jobs[i] );
+
+            splitter = std::thread( &bgzf_t::split, this );
+
+            for ( i = 0; i < nworker; ++i )
+                workers.push_back( std::thread( &bgzf_t::work, this ) );
+        }
+
+        ~bgzf_t()
+        {
+            size_t i;
+
+            free_q.close();
+            work_q.close();
+            order_q.close();
+            splitter.join();
+
+            for ( i = 0; i < workers.size(); ++i )
+                workers[i].join();
+
+            delete source;
+        }
+
+        bool next( const char *& data, size_t & len )
+        {
+            do {
+                if ( curr ) {
+                    curr->done = false;
+                    free_q.push( curr );
+                }
+
+                curr = NULL;
+
+                if ( !order_q.pop( curr ) )
+                    return false;
+
+                std::unique_lock<std::mutex> guard( curr->lock );
+
+                while ( !curr->done )
+                    curr->finished.wait( guard );
+            } while ( !curr->len );
+
+            data = &curr->out[0];
+            len = curr->len;
+
+            return true;
+        }
+    };
+
+    // inflater_t --------------------------------------------------------------------------------------------------- //
+
+    inflater_t * inflater_t::open( const char * path, source_t * source )
+    {
+        unsigned char hdr[BGZF_HDR_SZ];
+        const size_t nread = source->read( hdr, sizeof( hdr ) );
+
+        source->unread( hdr, nread );
+
+        if ( is_bgzf( hdr, nread ) )
+            return new bgzf_t( path, source );
+
+        return new stream_t( path, source );
+    }
+
+    inflater_t * inflater_t::read_ahead( const char *, source_t * source )
+    {
+        return new ahead_t( source );
+    }
+
+    // deflater_t --------------------------------------------------------------------------------------------------- //
+
+    class deflate_job_t
+    {
+    public:
+        const char * path;
+        std::vector<char> in;
+        std::vector<char> out;
+        size_t out_len;
+        bool done;
+        std::mutex lock;
+        std::condition_variable finished;
+
+        deflate_job_t( const char * path ) :
+            path( path ),
+            out_len( 0 ),
+            done( false )
+        {
+        }
+    };
+
+    static
+    void put_le( unsigned char * dst, unsigned long val, int nbyte )
+    {
+        int i;
+
+        for ( i = 0; i < nbyte; ++i, val >>= 8 )
+            dst[i] = val & 0xff;
+    }
+
+    static
+    size_t deflate_threads()
+    {
+        return std::min( std::max( std::thread::hardware_concurrency(), 1u ), unsigned( BGZF_THREADS_MAX ) );
+    }
+
+    // the deflate threads of every deflater, started with the first job
+    class deflate_pool_t
+    {
+    private:
+        queue_t<deflate_job_t *> work_q;
+        std::vector<std::thread> workers;
+        // jobs submitted and not yet deflated, by every deflater
+        std::atomic<size_t> nqueued;
+
+        void work();
+
+    public:
+        deflate_pool_t() :
+            work_q( 2 * deflate_threads() + 2 ),
+            nqueued( 0 )
+        {
+            size_t i;
+
+            for ( i = 0; i < deflate_threads(); ++i )
+                workers.push_back( std::thread( &deflate_pool_t::work, this ) );
+        }
+
+        void submit( deflate_job_t * job )
+        {
+            nqueued += 1;
+            work_q.push( job );
+        }
+
+        // enough queued to keep every thread busy
+        bool busy() const
+        {
+            return nqueued >= 2 * workers.size();
+        }
+
+        // never destroyed: its threads may still be waiting for work when
+        // the process exits, or be the ones calling exit() on an error
+        static deflate_pool_t & get()
+        {
+            static deflate_pool_t * pool = new deflate_pool_t();
+
+            return *pool;
+        }
+    };
+
+    void deflate_pool_t::work()
+    {
+        deflate_job_t * job = NULL;
+        bool init = false;
+        z_stream z;
+
+        memset( &z, 0, sizeof( z ) );
+
+        while ( work_q.pop( job ) ) {
+            const size_t in_len = job->in.size();
+            size_t i;
+
+            // raw deflate: the gzip wrapper of each block is written here
+            if ( !init && deflateInit2( &z, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY ) != Z_OK )
+                GZ_ERROR( job->path, "failed to initialize zlib" );
+
+            init = true;
+
+            job->out.resize( ( in_len + BGZF_BLOCK_DATA_SZ - 1 ) / BGZF_BLOCK_DATA_SZ * BGZF_BLOCK_SZ );
+            job->out_len = 0;
+
+            for ( i = 0; i < in_len; i += BGZF_BLOCK_DATA_SZ ) {
+                const size_t isize = std::min( in_len - i, size_t( BGZF_BLOCK_DATA_SZ ) );
+                unsigned char * hdr = reinterpret_cast<unsigned char *>( &job->out[job->out_len] );
+                Bytef * in = reinterpret_cast<Bytef *>( &job->in[i] );
+                size_t bsize;
+
+                deflateReset( &z );
+                z.next_in = in;
+                z.avail_in = isize;
+                z.next_out = hdr + BGZF_HDR_SZ;
+                z.avail_out = BGZF_BLOCK_SZ - BGZF_HDR_SZ - 8;
+
+                if ( deflate( &z, Z_FINISH ) != Z_STREAM_END )
+                    GZ_ERROR( job->path, "BGZF block overflow" );
+
+                bsize = BGZF_HDR_SZ + z.total_out + 8;
+
+                // gzip header, with the BC extra subfield holding the block size
+                hdr[0] = 0x1f;
+                hdr[1] = 0x8b;
+                hdr[2] = 8;
+                hdr[3] = 4;
+                put_le( hdr + 4, 0, 4 );
+                hdr[8] = 0;
+                hdr[9] = 0xff;
+                put_le( hdr + 10, 6, 2 );
+                hdr[12] = 'B';
+                hdr[13] = 'C';
+                put_le( hdr + 14, 2, 2 );
+                put_le( hdr + 16, bsize - 1, 2 );
+                put_le( hdr + bsize - 8, crc32( crc32( 0L, Z_NULL, 0 ), in, isize ), 4 );
+                put_le( hdr + bsize - 4, isize, 4 );
+
+                job->out_len += bsize;
+            }
+
+            nqueued -= 1;
+
+            {
+                std::lock_guard<std::mutex> guard( job->lock );
+                job->done = true;
+                job->finished.notify_one();
+            }
+        }
+
+        if ( init )
+            deflateEnd( &z );
+    }
+
+    deflater_t::deflater_t( const char * path, const int fd ) :
+        path( path ),
+        fd( fd ),
+        max_jobs( 2 * deflate_threads() + 2 ),
+        job_sz( BGZF_BLOCK_DATA_SZ ),
+        curr( NULL )
+    {
+    }
+
+    deflater_t::~deflater_t()
+    {
+        // an empty block marks the end of BGZF data
+        static const unsigned char eof[] = {
+            0x1f, 0x8b, 0x08, 0x04, 0x00, 0x00, 0x00, 0x00, 0x00, 0xff, 0x06, 0x00, 0x42, 0x43,
+            0x02, 0x00, 0x1b, 0x00, 0x03, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
+        };
+        size_t i;
+
+        if ( curr && !curr->in.empty() )
+            submit();
+
+        while ( retire( true ) ) ;
+
+        write_all( reinterpret_cast<const char *>( eof ), sizeof( eof ) );
+
+        for ( i = 0; i < jobs.size(); ++i )
+            delete jobs[i];
+    }
+
+    // a spare job, a new one while there are fewer than max_jobs,
+    // or else the first pending job, once it is written
+    deflate_job_t * deflater_t::next_job()
+    {
+        deflate_job_t * job;
+
+        while ( retire( false ) ) ;
+
+        if ( spare.empty() && jobs.size() < max_jobs ) {
+            jobs.push_back( new deflate_job_t( path ) );
+            spare.push_back( jobs.back() );
+        }
+
+        if ( spare.empty() )
+            retire( true );
+
+        job = spare.back();
+        spare.pop_back();
+
+        return job;
+    }
+
+    void deflater_t::write( const char * data, size_t len )
+    {
+        while ( len ) {
+            size_t nbyte;
+
+            if ( !curr )
+                curr = next_job();
+
+            nbyte = std::min( len, job_sz - curr->in.size() );
+
+            // grown with the data rather than to a whole job up front
+            if ( curr->in.capacity() < curr->in.size() + nbyte )
+                curr->in.reserve( std::min( job_sz, std::max( curr->in.size() + nbyte, 2 * curr->in.capacity() ) ) );
+
+            curr->in.insert( curr->in.end(), data, data + nbyte );
+            data += nbyte;
+            len -= nbyte;
+
+            if ( curr->in.size() == job_sz )
+                submit();
+        }
+    }
+
+    void deflater_t::submit()
+    {
+        // the pool is shared, so rather than queue more than it can keep up
+        // with, wait for this output's own jobs
+        while ( deflate_pool_t::get().busy() && retire( true ) ) ;
+
+        pending.push_back( curr );
+        deflate_pool_t::get().submit( curr );
+        curr = NULL;
+        job_sz = std::min( 2 * job_sz, size_t( BGZF_JOB_BLOCKS * BGZF_BLOCK_DATA_SZ ) );
+    }
+
+    bool deflater_t::retire( const bool wait )
+    {
+        deflate_job_t * job;
+
+        if ( pending.empty() )
+            return false;
+
+        job = pending.front();
+
+        {
+            std::unique_lock<std::mutex> guard( job->lock );
+
+            if ( !job->done && !wait )
+                return false;
+
+            while ( !job->done )
+                job->finished.wait( guard );
+        }
+
+        pending.pop_front();
+        write_all( &job->out[0], job->out_len );
+        job->in.clear();
+        job->done = false;
+        spare.push_back( job );
+
+        return true;
+    }
+
+    void deflater_t::write_all( const char * data, size_t len )
+    {
+        while ( len ) {
+            const ssize_t nbyte = ::write( fd, data, len );
+
+            if ( nbyte < 0 ) {
+                if ( errno == EINTR )
+                    continue;
+
+                GZ_ERROR( path, strerror( errno ) );
+            }
+
+            data += nbyte;
+            len -= nbyte;
+        }
+    }
+}
@@ -0,0 +1,102 @@
+
+#ifndef GZIP_H
+#define GZIP_H
+
+#include <cstdio>
+#include <deque>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "queue.hpp"
+
+// decompressed data is handed out in windows of this size
+#define GZ_CHUNK_SZ ( 1 << 20 )
+// BGZF blocks inflated together by one worker
+#define BGZF_JOB_BLOCKS 16
+// upper bound on BGZF inflate and deflate threads
+#define BGZF_THREADS_MAX 8
+// uncompressed bytes per BGZF block written, so that even incompressible
+// data stays within the 64 KiB block limit
+#define BGZF_BLOCK_DATA_SZ 0xff00
+
+namespace gzip
+{
+    // compressed bytes from a memory-mapped file or a stdio stream
+    class source_t
+    {
+    private:
+        const unsigned char * mem;
+        size_t mem_len;
+        size_t mem_pos;
+        FILE * file;
+        std::string pending;
+
+    public:
+        source_t( const char *, size_t );
+        source_t( FILE * );
+        // read up to n bytes, returning fewer only at the end of input
+        size_t read( unsigned char *, size_t );
+        // push bytes back, to be read again before anything else
+        void unread( const unsigned char *, size_t );
+    };
+
+    // whether data begins with the gzip magic bytes
+    bool is_gzip( const unsigned char *, size_t );
+
+    // gzip or BGZF decompression running on background threads
+    class inflater_t
+    {
+    public:
+        virtual ~inflater_t() { }
+        // the next window of decompressed data, valid until the following call;
+        // false once the input is exhausted
+        virtual bool next( const char *&, size_t & ) = 0;
+        // BGZF input is inflated block-parallel, plain gzip on a read-ahead thread;
+        // the inflater takes ownership of source
+        static inflater_t * open( const char * path, source_t * source );
+        // uncompressed input, passed through as is, but read ahead on a thread
+        // of its own all the same, so that reading a pipe overlaps with parsing
+        static inflater_t * read_ahead( const char * path, source_t * source );
+    };
+
+    class deflate_job_t;
+
+    // BGZF compression: data is cut into runs of blocks that are deflated on
+    // a thread pool shared by every deflater, and written to fd in order by
+    // whichever thread writes to the deflater; jobs, and their buffers, are
+    // only allocated as the data needs them, and the first jobs are short,
+    // so that many small outputs stay small
+    class deflater_t
+    {
+    private:
+        const char * const path;
+        const int fd;
+        const size_t max_jobs;
+        // a block to begin with, doubling up to BGZF_JOB_BLOCKS
+        size_t job_sz;
+        std::vector<deflate_job_t *> jobs;
+        std::vector<deflate_job_t *> spare;
+        // submitted, in the order they are written
+        std::deque<deflate_job_t *> pending;
+        deflate_job_t * curr;
+
+        deflater_t( const deflater_t & );
+        deflater_t & operator=( const deflater_t & );
+
+        deflate_job_t * next_job();
+        void submit();
+        // write the first pending job, waiting for it if wait, and
+        // whether there was one done to write
+        bool retire( const bool wait );
+        void write_all( const char *, size_t );
+
+    public:
+        deflater_t( const char * path, const int fd );
+        // compresses and writes whatever is left, followed by the BGZF EOF block
+        ~deflater_t();
+        void write( const char *, size_t );
+    };
+}
+
+#endif // GZIP_H
@@ -4,72 +4,382 @@
 #include <cstdlib>
 #include <cstring>
 
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
 #include "ifile.hpp"
 
 namespace ifile
 {
+    // find the first occurrence of any delim character in [begin, end),
+    // returning end if there is none. memchr is vectorized but will happily
+    // scan to the end of a mapping looking for a rare delimiter (e.g. '\r'
+    // in a UNIX file), so multiple delimiters are searched SCAN_SZ at a time
+    static
+    const char * find_first_of( const char * begin, const char * end, const char * delim )
+    {
+        const char * blk;
+
+        if ( !delim[1] ) {
+            const char * pch = static_cast<const char *>( memchr( begin, delim[0], end - begin ) );
+            return pch ? pch : end;
+        }
+
+        for ( blk = begin; blk < end; blk += SCAN_SZ ) {
+            const char * lim = ( end - blk > SCAN_SZ ) ? blk + SCAN_SZ : end,
+                       * hit = lim;
+            const char * d;
+
+            for ( d = delim; *d; ++d ) {
+                const char * pch = static_cast<const char *>( memchr( blk, *d, hit - blk ) );
+
+                if ( pch )
+                    hit = pch;
+            }
+
+            if ( hit < lim )
+                return hit;
+        }
+
+        return end;
+    }
+
+    // append [begin, end) to str, dropping line terminators (\n and \r\n)
+    static
+    void append_trimmed( std::string & str, const char * begin, const char * end )
+    {
+        while ( begin < end ) {
+            const char * nl = static_cast<const char *>( memchr( begin, '\n', end - begin ) );
+
+            if ( !nl ) {
+                str.append( begin, end - begin );
+                return;
+            }
+
+            if ( nl > begin && nl[-1] == '\r' )
+                str.append( begin, nl - begin - 1 );
+            else if ( nl > begin )
+                str.append( begin, nl - begin );
+            // the \r was at the end of the previous window
+            else if ( str.length() && str[str.length() - 1] == '\r' )
+                str.erase( str.length() - 1 );
+
+            begin = nl + 1;
+        }
+    }
+
+    // the window before the first fill(), empty but not the end of the input
+    static char empty[] = "";
+
     ifile_t::ifile_t( const char * path ) :
         path( path ),
         file( NULL ),
+        backend( STREAM ),
+        map( NULL ),
+        map_len( 0 ),
+        view( false ),
+        gz( NULL ),
+        nbytes( 0 ),
         line( 0 ),
         col( 0 ),
-        end( buf ),
-        ptr( buf )
+        end( empty ),
+        ptr( empty ),
+        seen_offset( 0 ),
+        seen_line( 0 ),
+        seen_bol( 0 )
     {
         if ( path ) {
             if ( !strcmp( path, "-" ) )
                 file = stdin;
-            else
+            else if ( !open_map() )
                 file = fopen( path, "rb" );
+
+            open_stream();
         }
     }
 
+    ifile_t::ifile_t( const ifile_t & parent, const char * begin, const char * end ) :
+        path( parent.path ),
+        file( NULL ),
+        backend( MMAP ),
+        map( parent.map ),
+        map_len( parent.map_len ),
+        view( true ),
+        gz( NULL ),
+        nbytes( 0 ),
+        line( 0 ),
+        col( 0 ),
+        end( const_cast<char *>( end ) ),
+        ptr( const_cast<char *>( begin ) ),
+        seen_offset( 0 ),
+        seen_line( 0 ),
+        seen_bol( 0 )
+    {
+    }
+
     ifile_t::~ifile_t()
     {
+        if ( gz ) {
+            delete gz;
+            gz = NULL;
+        }
+
+        if ( map && !view ) {
+            munmap( map, map_len );
+            map = NULL;
+        }
+
         if ( file && file != stdin ) {
             fclose( file );
             file = NULL;
         }
     }
 
+    bool ifile_t::open_map()
+    {
+        struct stat st;
+        void * addr;
+        const int fd = open( path, O_RDONLY );
+
+        if ( fd < 0 )
+            return false;
+
+        // pipes, devices and empty files are left to the streaming path
+        if ( fstat( fd, &st ) || !S_ISREG( st.st_mode ) || st.st_size < 1 ) {
+            close( fd );
+            return false;
+        }
+
+        addr = mmap( NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0 );
+        close( fd );
+
+        if ( addr == MAP_FAILED )
+            return false;
+
+        madvise( addr, st.st_size, MADV_SEQUENTIAL );
+
+        backend = MMAP;
+        map = static_cast<char *>( addr );
+        map_len = st.st_size;
+        ptr = map;
+        end = map + map_len;
+
+        return true;
+    }
+
+    // switch to the gzip backend if the input starts with the gzip magic bytes,
+    // otherwise start reading a streamed input ahead
+    void ifile_t::open_stream()
+    {
+        gzip::source_t * source = NULL;
+
+        if ( backend == MMAP ) {
+            if ( gzip::is_gzip( reinterpret_cast<const unsigned char *>( map ), map_len ) )
+                source = new gzip::source_t( map, map_len );
+        }
+        else if ( file ) {
+            // FASTA and FASTQ can't begin with 0x1f, so one byte of lookahead will do
+            const int chr = fgetc( file );
+
+            if ( chr != EOF )
+                ungetc( chr, file );
+
+            source = new gzip::source_t( file );
+
+            if ( chr != 0x1f ) {
+                gz = gzip::inflater_t::read_ahead( path, source );
+                return;
+            }
+        }
+
+        if ( !source )
+            return;
+
+        backend = GZIP;
+        gz = gzip::inflater_t::open( path, source );
+        ptr = empty;
+        end = empty;
+    }
+
     bool ifile_t::good() const
     {
-        return file != NULL;
+        return file != NULL || map != NULL;
+    }
+
+    bool ifile_t::mapping( const char *& begin, const char *& finish ) const
+    {
+        if ( backend != MMAP )
+            return false;
+
+        begin = map;
+        finish = map + map_len;
+
+        return true;
+    }
+
+    void ifile_t::consume()
+    {
+        if ( backend == MMAP ) {
+            ptr = NULL;
+            end = NULL;
+        }
+    }
+
+    size_t ifile_t::bytes() const
+    {
+        // a consumed mapping has ptr NULL
+        if ( backend == MMAP )
+            return ptr ? ptr - map : map_len;
+
+        return nbytes;
+    }
+
+    mark_t ifile_t::mark() const
+    {
+        mark_t m;
+
+        // a consumed mapping has ptr NULL
+        m.offset = ptr ? ptr - map : map_len;
+        m.line = line;
+        m.col = col;
+
+        return m;
+    }
+
+    // a mapping keeps no running line/column counts, so recover them when
+    // needed, counting lines on from the last position given, if it's before
+    void ifile_t::position( const mark_t & m, size_t & l, size_t & c ) const
+    {
+        std::lock_guard<std::mutex> guard( seen_lock );
+        const char * pos,
+                   * bol,
+                   * nl;
+
+        if ( backend != MMAP ) {
+            l = m.line;
+            c = m.col;
+            return;
+        }
+
+        if ( m.offset < seen_offset ) {
+            seen_offset = 0;
+            seen_line = 0;
+            seen_bol = 0;
+        }
+
+        pos = map + m.offset;
+        bol = map + seen_offset;
+        l = seen_line;
+
+        while ( ( nl = static_cast<const char *>( memchr( bol, '\n', pos - bol ) ) ) ) {
+            l += 1;
+            bol = nl + 1;
+        }
+
+        if ( bol == map + seen_offset )
+            bol = map + seen_bol;
+
+        seen_offset = m.offset;
+        seen_line = l;
+        seen_bol = bol - map;
+
+        c = ( l ? 1 : 0 ) + ( pos - bol );
+    }
+
+    void ifile_t::report( const char * kind, const mark_t & m, const char * msg, va_list args ) const
+    {
+        size_t l, c;
+        position( m, l, c );
+        fprintf( stderr, "\n%s (file: %s, line: %ld, column: %ld): ", kind, path, l, c );
+        vfprintf( stderr, msg, args );
+        fprintf( stderr, "\n" );
     }
 
     void ifile_t::error( const char * msg, ... ) const
     {
         va_list args;
-        fprintf( stderr, "\nERROR (file: %s, line: %ld, column: %ld): ", path, line, col );
         va_start( args, msg );
-        vfprintf( stderr, msg, args );
+        report( "ERROR", mark(), msg, args );
         va_end( args );
-        fprintf( stderr, "\n" );
         exit( 1 );
     }
 
     void ifile_t::warning ( const char * msg, ... ) const
     {
         va_list args;
-        fprintf( stderr, "\nWARNING (file: %s, line: %ld, column: %ld): ", path, line, col );
         va_start( args, msg );
-        vfprintf( stderr, msg, args );
+        report( "WARNING", mark(), msg, args );
+        va_end( args );
+    }
+
+    void ifile_t::error_at( const mark_t & m, const char * msg, ... ) const
+    {
+        va_list args;
+        va_start( args, msg );
+        report( "ERROR", m, msg, args );
+        va_end( args );
+        exit( 1 );
+    }
+
+    void ifile_t::warning_at( const mark_t & m, const char * msg, ... ) const
+    {
+        va_list args;
+        va_start( args, msg );
+        report( "WARNING", m, msg, args );
         va_end( args );
-        fprintf( stderr, "\n" );
     }
     
     bool ifile_t::fill()
     {
-        ptr = fgets( buf, BUF_SZ, file );
+        switch ( backend ) {
+        case MMAP:
+            // the mapping is a single window, once it is consumed we're done
+            ptr = NULL;
+            end = NULL;
+            break;
 
-        if ( ptr )
-            end = buf + strlen( buf );
-        else
-            end = buf;
+        // streamed and gzip input both come a window at a time from gz
+        default: {
+            const char * data;
+            size_t len;
+
+            if ( gz && gz->next( data, len ) ) {
+                ptr = const_cast<char *>( data );
+                end = ptr + len;
+                nbytes += len;
+            }
+            else {
+                ptr = NULL;
+                end = NULL;
+            }
+
+            break;
+        }
+        }
 
         return ptr != NULL;
     }
 
+    // move ptr up to pos, keeping the line/column counts of streamed and inflated input
+    void ifile_t::advance( const char * pos )
+    {
+        if ( backend != MMAP ) {
+            const char * nl;
+
+            while ( ( nl = static_cast<const char *>( memchr( ptr, '\n', pos - ptr ) ) ) ) {
+                next_col( nl - ptr );
+                next_line();
+                ptr = const_cast<char *>( nl + 1 );
+            }
+
+            next_col( pos - ptr );
+        }
+
+        ptr = const_cast<char *>( pos );
+    }
+
     char ifile_t::getc()
     {
         char chr = EOF;
@@ -79,11 +389,7 @@ namespace ifile
 
         if ( ptr ) {
             chr = ptr[0];
-            if ( chr == '\n' )
-                next_line();
-            else if ( chr != '\r' )
-                next_col();
-            ++ptr;
+            advance( ptr + 1 );
         }
 
         return chr;
@@ -91,76 +397,138 @@ namespace ifile
 
     void ifile_t::skip_ws()
     {
-        while( true ) {
-            switch ( getc() ) {
-            case ' ':
-            case '\t':
-            case '\r':
-            case '\n':
-                break;
-            case EOF:
-                return;
-            default:
-                --ptr;
-                prev_col();
+        for ( ; ptr != NULL; fill() ) {
+            const char * pch = ptr;
+
+            while ( pch < end && ( *pch == ' ' || *pch == '\t' || *pch == '\r' || *pch == '\n' ) )
+                ++pch;
+
+            advance( pch );
+
+            if ( pch < end )
                 return;
-            }
         }
     }
 
     void ifile_t::extend_until( std::string & str, const char * delim, bool trim )
     {
-        for( ; ptr != NULL ; fill() ) {
-            const char * pch = strpbrk( ptr, delim );
-            const size_t len = ( end > buf ) ? end - buf : 0;
-            size_t truncate = 0;
-
-            if ( pch ) {
-                const size_t nchar = ( pch > ptr ) ? pch - ptr : 0;
-
-                if ( nchar ) {
-                    str.append( ptr, nchar );
+        for ( ; ptr != NULL; fill() ) {
+            const char * pch = find_first_of( ptr, end, delim );
 
-                    switch ( pch[0] ) {
-                    case '\n':
-                        next_col( nchar - 1 );
-                        next_line();
-                        break;
-                    case '\r':
-                        next_col();
-                        break;
-                    }
+            if ( trim )
+                append_trimmed( str, ptr, pch );
+            else
+                str.append( ptr, pch - ptr );
 
-                    ptr += nchar;
-                }
+            advance( pch );
 
+            if ( pch < end ) {
                 if ( trim )
                     skip_ws();
 
                 return;
             }
+        }
+    }
+
+    bool ifile_t::view_until( const char *& data, size_t & len, const char * delim, bool trim )
+    {
+        const char * pch,
+                   * last;
+
+        if ( backend != MMAP || ptr == NULL )
+            return false;
+
+        pch = find_first_of( ptr, end, delim );
+        last = pch;
+
+        // the line ending the field
+        if ( trim && last > ptr && last[-1] == '\n' ) {
+            --last;
+            if ( last > ptr && last[-1] == '\r' )
+                --last;
+        }
 
-            if ( len > 0 ) {
-                if ( end[-1] == '\n' ) {
-                    size_t nchar = 1;
+        // it spans lines, which have to be joined
+        if ( trim && memchr( ptr, '\n', last - ptr ) )
+            return false;
 
-                    if ( len > 1 && end[-2] == '\r' )
-                        nchar = 2;
+        data = ptr;
+        len = last - ptr;
+        advance( pch );
 
-                    if ( trim )
-                        truncate = nchar;
+        if ( pch < end ) {
+            if ( trim )
+                skip_ws();
+        }
+        else
+            fill();
 
-                    next_col( len - nchar );
-                    next_line();
+        return true;
+    }
+
+    void ifile_t::extend_bytes( std::vector<unsigned char> & bytes, const char * delim )
+    {
+        for ( ; ptr != NULL; fill() ) {
+            const char * pch = find_first_of( ptr, end, delim );
+
+            bytes.insert(
+                bytes.end(),
+                reinterpret_cast<const unsigned char *>( ptr ),
+                reinterpret_cast<const unsigned char *>( pch )
+                );
+            advance( pch );
+
+            if ( pch < end )
+                return;
+        }
+    }
+
+    // parse whitespace-separated integer scores up to the first delim character
+    // straight into quals, clamping them to [0, 255]. the record end is found
+    // with memchr, after which each byte costs a compare or a multiply-add
+    void ifile_t::extend_scores( std::vector<unsigned char> & quals, const char * delim )
+    {
+        unsigned val = 0;
+        bool intok = false;
+
+        for ( ; ptr != NULL; fill() ) {
+            const char * pch = find_first_of( ptr, end, delim ),
+                       * p;
+            size_t n = quals.size();
+
+            // a score is at least a digit and a separator, bar the last one
+            quals.resize( n + ( pch - ptr ) / 2 + 1 );
+
+            for ( p = ptr; p < pch; ++p ) {
+                const unsigned dig = static_cast<unsigned char>( *p ) - '0';
+
+                if ( dig < 10 ) {
+                    val = val * 10 + dig;
+                    if ( val > 255 )
+                        val = 255;
+                    intok = true;
+                }
+                else if ( *p == ' ' || *p == '\t' || *p == '\r' || *p == '\n' ) {
+                    if ( intok )
+                        quals[n++] = val;
+                    val = 0;
+                    intok = false;
                 }
-                else if ( end[-1] == '\r' ) {
-                    next_col( len - 1 );
+                else {
+                    advance( p );
+                    error( "malformed file: invalid quality score character %c", *p );
                 }
-                else
-                    next_col( len );
             }
 
-            str.append( ptr, len - truncate );
+            quals.resize( n );
+            advance( pch );
+
+            if ( pch < end )
+                break;
         }
+
+        if ( intok )
+            quals.push_back( val );
     }
 }
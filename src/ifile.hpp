@@ -2,13 +2,33 @@
 #ifndef IFILE_H
 #define IFILE_H
 
+#include <cstdarg>
+#include <mutex>
 #include <string>
 #include <vector>
 
-#define BUF_SZ 256 
+#include "gzip.hpp"
+
+#define SCAN_SZ 256
 
 namespace ifile
 {
+    enum backend_t {
+        STREAM,
+        MMAP,
+        GZIP
+    };
+
+    // how far a file had been read, so that an error or warning about a
+    // record can be given at its position after reading has moved on
+    class mark_t
+    {
+    public:
+        size_t offset;
+        size_t line;
+        size_t col;
+    };
+
     class ifile_t
     {
     public:
@@ -16,12 +36,30 @@ namespace ifile
 
     private:
         FILE * file;
+        // regular files are memory-mapped and handed out as a single window,
+        // all other inputs (stdin, pipes) are streamed in on a read-ahead thread,
+        // and gzip input of either kind is inflated in the background
+        backend_t backend;
+        char * map;
+        size_t map_len;
+        // a view of part of another file's mapping, which it doesn't own
+        bool view;
+        // the read-ahead or inflate threads, for anything but a plain mapping
+        gzip::inflater_t * gz;
+        // bytes handed out by fill(), after any decompression
+        size_t nbytes;
         size_t line;
         size_t col;
-        char buf[BUF_SZ];
         char * end;
         char * ptr;
         std::vector<size_t> cols;
+        // for a mapping, the last position given, as an offset, its line
+        // and the offset that line begins at, to count on from there;
+        // locked, as a reader thread and its consumer may both report
+        mutable std::mutex seen_lock;
+        mutable size_t seen_offset;
+        mutable size_t seen_line;
+        mutable size_t seen_bol;
 
         inline
         void next_col( const size_t ncol=1 ) {
@@ -49,17 +87,42 @@ namespace ifile
             }
         }
 
+        bool open_map();
+        void open_stream();
         bool fill();
+        void advance( const char * );
+        void position( const mark_t &, size_t &, size_t & ) const;
+        void report( const char *, const mark_t &, const char *, va_list ) const;
 
     public:
         ifile_t( const char * path=NULL );
+        // a view of [begin, end) of a mapped file, to read part of it on another thread;
+        // errors and warnings give positions in the whole file
+        ifile_t( const ifile_t &, const char * begin, const char * end );
         ~ifile_t();
         bool good() const;
+        // the whole of a memory-mapped (uncompressed) file, if this is one
+        bool mapping( const char *&, const char *& ) const;
+        // mark a mapped file read to the end, once views of it have been read instead
+        void consume();
         void error( const char *, ... ) const;
         void warning ( const char *, ... ) const;
+        // where reading has got to, for error_at and warning_at
+        mark_t mark() const;
+        void error_at( const mark_t &, const char *, ... ) const;
+        void warning_at( const mark_t &, const char *, ... ) const;
         char getc();
         void skip_ws();
         void extend_until( std::string &, const char *, bool trim=true );
+        void extend_scores( std::vector<unsigned char> &, const char * );
+        // append raw bytes up to the first delim character, as they are
+        void extend_bytes( std::vector<unsigned char> &, const char * );
+        // rather than appending, point data at what extend_until would append,
+        // if it is a single line of a memory-mapped file; otherwise returns false
+        // and reads nothing, so the caller can fall back to extend_until
+        bool view_until( const char *& data, size_t & len, const char *, bool trim=true );
+        // bytes of (uncompressed) input read so far
+        size_t bytes() const;
     };
 }
 
@@ -1,5 +1,4 @@
 
-#include <algorithm>
 #include <cctype>
 #include <cmath>
 #include <cstdio>
@@ -8,46 +7,29 @@
 #include <stdlib.h>
 
 #include "argparse.hpp"
+#include "dedup.hpp"
+#include "filter.hpp"
+#include "pipeline.hpp"
+#include "profile.hpp"
 #include "seq.hpp"
+#include "stats.hpp"
 
 #if 0
 static const char * const valid_chars = "ACGTNacgtn";
 static long char_lookup[256];
 #endif
 
-const size_t BUF_LEN = 60;
-
-// vec must be sorted
-void fprint_vector_stats( FILE * file, std::vector<size_t> & vec, const char * hdr, bool do_json )
+void fprint_length_stats( FILE * file, const stats::lengths_t & lengths, const char * hdr, bool do_json )
 {
-    double sum = 0.,
-           var = 0.,
-           mean = 0.,
-           median = 0.;
-           
-    long min = 0,
-         two5 = 0,
-         ninetyseven5 = 0,
-         max = 0;
-         
-    size_t i;
-
-    for ( i = 0; i < vec.size(); ++i ) {
-        sum += vec[i];
-        var += vec[i] * vec[i];
-    }
+    const double var = lengths.variance(),
+                 mean = lengths.mean(),
+                 median = lengths.median();
 
-    // remember, i == vec.size()
-
-    if ( vec.size() ) {
-        var = ( var - ( sum * sum ) / vec.size() ) / ( vec.size() - 1 );
-        mean = sum / i;
-        median = ( i % 2 ) ? 1.0 * vec[i / 2] : 0.5 * ( vec[i / 2] + vec[i / 2 - 1] );
-        min = vec[0];
-        two5 = vec[long( 0.025 * i )];
-        ninetyseven5 = vec[long( 0.975 * i )];
-        max = vec[i - 1];
-    }
+    const long n = lengths.count(),
+               min = lengths.min(),
+               two5 = lengths.at( long( 0.025 * n ) ),
+               ninetyseven5 = lengths.at( long( 0.975 * n ) ),
+               max = lengths.max();
 
     if (do_json) {
         fprintf( file, ",\n\t\"%s\": {"
@@ -93,29 +75,226 @@ void fprint_vector_stats( FILE * file, std::vector<size_t> & vec, const char * h
         }
 }
 
+// reads and retained fragments for each sample, when demultiplexing
+void fprint_samples( FILE * file, const argparse::args_t & args, const filter::counts_t & counts, bool do_json )
+{
+    size_t i;
+
+    if ( do_json ) {
+        fprintf( file, ",\n\t\"samples\": {" );
+
+        for ( i = 0; i < args.samples.size(); ++i )
+            fprintf( file, "%s"
+                     "\n\t\t\"%s\": {\"barcode\": \"%s\", \"reads\": %ld, \"retained fragments\": %ld}",
+                     i ? "," : "",
+                     args.samples[i].c_str(),
+                     args.barcodes[i].c_str(),
+                     i < counts.sample_reads.size() ? counts.sample_reads[i] : 0L,
+                     i < counts.sample_fragments.size() ? counts.sample_fragments[i] : 0L
+                   );
+
+        fprintf( file, "},"
+                 "\n\t\"unassigned reads\":    %ld,"
+                 "\n\t\"ambiguous reads\":     %ld",
+                 counts.unassigned,
+                 counts.ambiguous
+               );
+    }
+    else {
+        fprintf( file, "\nsamples (reads / retained fragments):\n" );
+
+        for ( i = 0; i < args.samples.size(); ++i )
+            fprintf( file,
+                     "    %-20s %s  %ld / %ld\n",
+                     args.samples[i].c_str(),
+                     args.barcodes[i].c_str(),
+                     i < counts.sample_reads.size() ? counts.sample_reads[i] : 0L,
+                     i < counts.sample_fragments.size() ? counts.sample_fragments[i] : 0L
+                   );
+
+        fprintf( file,
+                 "    unassigned reads:    %ld\n"
+                 "    ambiguous reads:     %ld\n",
+                 counts.unassigned,
+                 counts.ambiguous
+               );
+    }
+}
+
+// what became of the pairs, for paired-end reads
+void fprint_pairs( FILE * file, const argparse::args_t & args, const filter::counts_t & counts, bool do_json )
+{
+    const char * const fates[] = { "written as pairs", "written as singletons", "dropped" };
+
+    if ( do_json )
+        fprintf( file, ",\n\t\"pairs\": {"
+                 "\n\t\t\"total\":             %ld,"
+                 "\n\t\t\"both mates\":        %ld,"
+                 "\n\t\t\"one mate\":          %ld,"
+                 "\n\t\t\"neither mate\":      %ld,"
+                 "\n\t\t\"one mate pairs\":    \"%s\","
+                 "\n\t\t\"read counts\":       \"both mates\"}",
+                 counts.pairs,
+                 counts.both_mates,
+                 counts.one_mate,
+                 counts.pairs - counts.both_mates - counts.one_mate,
+                 fates[args.pairing]
+               );
+    else
+        fprintf( file, "\npairs (with fragments retained from):\n"
+                 "    total:               %ld\n"
+                 "    both mates:          %ld\n"
+                 "    one mate:            %ld (%s)\n"
+                 "    neither mate:        %ld\n"
+                 "    (the run summary counts the reads of both mates,\n"
+                 "    and of their fragments only those written)\n",
+                 counts.pairs,
+                 counts.both_mates,
+                 counts.one_mate,
+                 fates[args.pairing],
+                 counts.pairs - counts.both_mates - counts.one_mate
+               );
+}
+
+// unique and duplicate fragments, when dropping duplicates
+void fprint_dedup( FILE * file, const argparse::args_t & args, const dedup::dedup_t & dedup, bool do_json )
+{
+    if ( do_json ) {
+        fprintf( file, ",\n\t\"duplicates\": {"
+                 "\n\t\t\"unique fragments\":    %ld,"
+                 "\n\t\t\"dropped fragments\":   %ld,"
+                 "\n\t\t\"approximate\":         %s",
+                 dedup.uniques(),
+                 dedup.duplicates(),
+                 dedup.approximate() ? "true" : "false"
+               );
+
+        if ( args.derep )
+            fprintf( file, ","
+                     "\n\t\t\"left out of derep\":   %ld",
+                     dedup.late()
+                   );
+
+        fprintf( file, "}" );
+    }
+    else {
+        fprintf( file, "\nduplicates:\n"
+                 "    unique fragments:    %ld\n"
+                 "    dropped fragments:   %ld\n"
+                 "    approximate:         %s\n",
+                 dedup.uniques(),
+                 dedup.duplicates(),
+                 dedup.approximate() ? "yes, past half the memory cap" : "no"
+               );
+
+        if ( args.derep )
+            fprintf( file,
+                     "    left out of derep:   %ld\n",
+                     dedup.late()
+                   );
+    }
+}
+
+void fprint_profile(
+    FILE * file,
+    const profile::times_t & times,
+    const double wall,
+    const double cpu,
+    const size_t bytes_in,
+    const size_t bytes_out,
+    const size_t nread,
+    bool do_json
+    )
+{
+    size_t i;
+
+    if ( do_json ) {
+        fprintf( file, ",\n\"profile\":{"
+                 "\n\t\"wall time\":           %g,"
+                 "\n\t\"cpu time\":            %g,"
+                 "\n\t\"bytes read\":          %lu,"
+                 "\n\t\"bytes written\":       %lu,"
+                 "\n\t\"reads per second\":    %g,"
+                 "\n\t\"peak rss (kB)\":       %ld,"
+                 "\n\t\"allocations\":         %lu,"
+                 "\n\t\"allocated bytes\":     %lu",
+                 wall,
+                 cpu,
+                 ( unsigned long ) bytes_in,
+                 ( unsigned long ) bytes_out,
+                 nread / wall,
+                 profile::peak_rss(),
+                 ( unsigned long ) profile::allocations(),
+                 ( unsigned long ) profile::allocated_bytes()
+               );
+
+        for ( i = 0; i < profile::NSTAGE; ++i )
+            fprintf( file, ","
+                     "\n\t\"%s\": {\"wall time\": %g, \"cpu time\": %g}",
+                     profile::stage_names[i],
+                     times.wall[i],
+                     times.cpu[i]
+                   );
+
+        fprintf( file, "\n\t}" );
+    }
+    else {
+        fprintf( file, "\nprofile:\n"
+                 "    wall time:           %g\n"
+                 "    cpu time:            %g\n"
+                 "    bytes read:          %lu\n"
+                 "    bytes written:       %lu\n"
+                 "    reads per second:    %g\n"
+                 "    peak rss (kB):       %ld\n"
+                 "    allocations:         %lu\n"
+                 "    allocated bytes:     %lu\n",
+                 wall,
+                 cpu,
+                 ( unsigned long ) bytes_in,
+                 ( unsigned long ) bytes_out,
+                 nread / wall,
+                 profile::peak_rss(),
+                 ( unsigned long ) profile::allocations(),
+                 ( unsigned long ) profile::allocated_bytes()
+               );
+
+        // stage times are summed over the threads running each stage
+        for ( i = 0; i < profile::NSTAGE; ++i )
+            fprintf( file,
+                     "    %-6s wall / cpu:   %g / %g\n",
+                     profile::stage_names[i],
+                     times.wall[i],
+                     times.cpu[i]
+                   );
+    }
+}
+
 // main ------------------------------------------------------------------------------------------------------------- //
 
 int main( int argc, const char * argv[] )
 {
     argparse::args_t args = argparse::args_t( argc, argv );
-    seq::parser_t * parser = NULL;
-    seq::seq_t seq = seq::seq_t();
-    long ncontrib = 0L;
-    
-    long      total_bases = 0L,
-              q_over10    = 0L,
-              q_over20    = 0L,
-              q_over30    = 0L;
-    
-    double    q_score_sum = 0.0;
-    
+    const double start_wall = profile::wall_time(),
+                 start_cpu = profile::process_cpu_time();
+    profile::times_t times;
+    profile::times_t * const ptimes = args.profile ? &times : NULL;
+    seq::parser_t * parser = NULL,
+                  * mate_parser = NULL;
+    filter::filter_t filter = filter::filter_t( filter::settings_t( args ) );
+    ofile::writer_t writer = ofile::writer_t( args.format == argparse::FASTQ, args.width );
+    filter::counts_t counts;
+    dedup::dedup_t * dedup = args.dedup ? new dedup::dedup_t( args.dedup_memory << 20, args.derep != NULL ) : NULL;
+
     // initialize the parser
     if ( args.fastq )
-        parser = new seq::parser_t( args.fastq );
+        parser = new seq::parser_t( args.fastq, args.threads );
     else
         parser = new seq::parser_t( args.fasta, args.qual );
 
-    if ( !parser ) {
+    if ( args.mates )
+        mate_parser = new seq::parser_t( args.mates, args.threads );
+
+    if ( !parser || ( args.mates && !mate_parser ) ) {
         fprintf( stderr, "\nERROR: failed to initialize parser\n" );
         exit( 1 );
     }
@@ -129,242 +308,82 @@ int main( int argc, const char * argv[] )
         char_lookup[valid_chars[i]] = i;
 
 #endif
-    std::vector<size_t> read_lengths;
-    std::vector<size_t> fragment_lengths;
-
-    for ( ; parser->next( seq ); seq.clear() ) {
-        // maxto is the maximum value of "to",
-        // NOT THE UPPER BOUND
-        
-        if (seq.length == 0) continue;
-        
-        const size_t maxto = seq.length - args.min_length;
-        size_t nfragment = 0,
-               to = 0;
-
-        read_lengths.push_back( seq.length );
-        total_bases += seq.length;
-        
-        for (size_t i = 0; i < seq.length; ++i ) {
-            q_score_sum += seq.quals[i];
-            if (seq.quals[i] >= 10L) {
-                q_over10 ++;
-                if (seq.quals[i] >= 20L) {
-                    q_over20++;
-                    if (seq.quals[i] >= 30L) {
-                        q_over30++;
-                    }
-                }
-            }
-        }
-        
-
-        if ( seq.length < args.min_length )
-            continue;
-
-        // compare the sequence prefix to the tag,
-        // if it matches by at least tag_mismatch,
-        // keep the sequence, otherwise discard
-        if ( args.tag_length ) {
-            size_t mismatch = 0;
-
-            if ( maxto < args.tag_length )
-                continue;
 
-            for ( to = 0; to < args.tag_length; ++to ) {
-                // tolower -> case insensitive
-                if ( toupper( seq.seq[to] ) != toupper( args.tag[to] ) )
-                    mismatch += 1;
-            }
-
-            if ( mismatch > args.tag_mismatch )
-                continue;
-        }
-        
-        // gather read stats
-        
-        
+    if ( args.profile )
+        profile::count_allocations();
 
-        if ( args.punch ) {
-            size_t i;
-            unsigned long nambigs = 0UL;
+    // pairs always go through the pipeline, which parses the two files side by side
+    if ( mate_parser ) {
+        // the tag is at the 5' end of the first mate only
+        filter::settings_t mate_settings( args );
+        mate_settings.tag.clear();
+        mate_settings.tag_window = 0;
 
-            //char buf[BUF_LEN + 1];
-            //buf[BUF_LEN] = '\0';
+        pipeline::run( *parser, *mate_parser, filter, filter::filter_t( mate_settings ), args.pairing,
+                       writer, args.outputs, counts, args.threads, ptimes );
+    }
+    else if ( args.threads > 1 )
+        pipeline::run( *parser, filter, writer, args.outputs, counts, args.threads, ptimes, dedup );
+    else {
+        std::vector<seq::seq_t> reads( BATCH_SZ );
+        seq::arena_t arena;
+        filter::fragments_t frags;
+        std::vector<uint64_t> prints;
+        ofile::buffer_t * outs = new ofile::buffer_t[args.outputs.size()];
+        size_t nread,
+               i;
 
-            // print the read ID
-            
-            if (seq.length >= args.min_length) {
+        // the same batches as the pipeline, so each stage is timed a batch at a time
+        do {
+            {
+                profile::scope_t scope( ptimes, profile::PARSE );
 
-              char * buffer = new char[seq.length+1];
+                arena.reset();
 
-            
-              for ( i = 0; to < seq.length; ++i, ++to ) {
-                  if ( seq.quals[to] < args.min_qscore ) {
-                      buffer[i] = args.punch;
-                      nambigs ++;
-                      if (nambigs >= args.remove_count) {
-                        break;
-                      }
-                  }
-                  else
-                      buffer[i] = seq.seq[to];
-              }
-              
-              if (to == seq.length) {
-                buffer[to] = '\0';
-                
-              // print the remaining portion of the sequence
-                ncontrib ++;
-                
-                fragment_lengths.push_back( seq.length );
-              
-                fprintf(
-                  args.output,
-                  "%c%s\n",
-                  ( args.format == argparse::FASTQ ) ? '@' : '>',
-                  seq.id.c_str()
-                  );
-
-                 fprintf(
-                    args.output,
-                    ( args.format == argparse::FASTQ ) ? "%s" : "%s\n",
-                    buffer
-                    );
-                 
-                 
-                if ( args.format == argparse::FASTQ ) {
-                    fprintf( args.output, "\n+\n" );
-                    for ( i = 0; i < to; i += BUF_LEN ) {
-                        char buf[BUF_LEN + 1];
-                        const int nitem = ( to - i < BUF_LEN ) ? to - i : BUF_LEN;
-                        for ( int j = 0; j < nitem; ++j )
-                            buf[j] = ( char ) ( seq.quals[i + j] + 33 );
-                        buf[nitem] = '\0';
-                        fprintf( args.output, "%s", buf );
-                    }
-                    fprintf( args.output, "\n" );
-                }
-              }
-              delete [] buffer; 
-            }
-        }
-        // if we're splitting,
-        // continue the following process until we reach the end of the sequence,
-        // but only continue if there's enough left to produce a minimum-sized fragment
-        else while ( true ) {
-            size_t from = 0,
-                   i = 0,
-                   nambigs = 0;
-
-            // push through the sequence until the quality score meets the minimum
-            while ( ( to <= maxto ) && ( seq.quals[to] < args.min_qscore ) ) {
-                to += 1;
-            }
+                for ( nread = 0; nread < BATCH_SZ; ++nread ) {
+                    reads[nread].clear();
 
-            // if we don't have enough length left,
-            // skip to the next sequence
-            if ( to > maxto )
-                break;
-
-            // begin with positive quality score
-            from = to;
-
-            // build a read until we hit a low quality score,
-            // that is, unless we're skipping Ns or retaining homopolymers
-            for ( ; to < seq.length; ++to ) {
-                char curr = seq.seq[to],
-                     last = -1;
-
-                if ( seq.quals[to] < args.min_qscore ) {
-                    // if homopolymer (toupper -> case insensitive), continue (last == curr)
-                    if ( args.hpoly && toupper( last ) == toupper( curr ) )
-                        continue;
-                    // if skipping Ns, continue (without assigning last)
-                    else if ( args.ambig && ( curr == 'N' || curr == 'n' ) ) {
-                        nambigs += 1;
-                        continue;
-                    }
-                    // otherwise, ABORT!!!
-                    else
+                    if ( !parser->next( reads[nread], arena ) )
                         break;
                 }
-
-                last = curr;
             }
 
-            // "to" is now the upper bound
+            frags.clear();
+            filter.filter_batch( &reads[0], nread, counts, frags, ptimes );
 
-            // if our fragment isn't long enough,
-            // skip to the next fragment
-            if ( to - from - nambigs < args.min_length )
-                continue;
+            if ( dedup ) {
+                profile::scope_t scope( ptimes, profile::DEDUP );
 
-            // print the read ID
-            fprintf(
-                args.output,
-                "%c%s",
-                ( args.format == argparse::FASTQ ) ? '@' : '>',
-                seq.id.c_str()
-                );
-
-            // print the fragment identifier
-            if ( nfragment > 0 )
-                fprintf( args.output, " fragment=%ld\n", nfragment + 1 );
-            else {
-                fprintf( args.output, "\n" );
-                // if it's the first fragment,
-                // count the contributing read
-                ncontrib += 1;
+                dedup::fingerprints( &reads[0], frags, prints );
+                dedup->filter( &reads[0], frags, prints );
+                filter.count( frags, 0, counts );
             }
 
-            // print the read sequence
-            for ( i = from; i < to; i += BUF_LEN ) {
-                char buf[BUF_LEN + 1];
-                const size_t nitem = ( to - i < BUF_LEN ) ? to - i : BUF_LEN;
-                strncpy( buf, seq.seq.c_str() + i, nitem );
-                buf[nitem] = '\0';
-                fprintf(
-                    args.output,
-                    ( args.format == argparse::FASTQ ) ? "%s" : "%s\n",
-                    buf
-                    );
-            }
+            {
+                profile::scope_t scope( ptimes, profile::OUTPUT );
 
-            if ( args.format == argparse::FASTQ ) {
-                fprintf( args.output, "\n+\n" );
-                for ( i = from; i < to; i += BUF_LEN ) {
-                    char buf[BUF_LEN + 1];
-                    const int nitem = ( to - i < BUF_LEN ) ? to - i : BUF_LEN;
-                    for ( int j = 0; j < nitem; ++j )
-                        buf[j] = ( char ) ( seq.quals[i + j] + 33 );
-                    buf[nitem] = '\0';
-                    fprintf( args.output, "%s", buf );
-                }
-                fprintf( args.output, "\n" );
-            }
-#if 0
-            // for printing quality scores
-            fprintf( args.output, "+\n" );
-
-            for ( i = from; i < to; ++i ) {
-                char s[] = " ";
+                for ( i = 0; i < args.outputs.size(); ++i )
+                    outs[i].clear();
 
-                if ( i == from )
-                    s[0] = '\0';
+                filter::format( writer, &reads[0], frags, outs );
 
-                fprintf( args.output, "%s%ld", s, ( *seq.quals )[i] );
+                for ( i = 0; i < args.outputs.size(); ++i )
+                    args.outputs[i]->write( outs[i] );
             }
+        } while ( nread == BATCH_SZ );
 
-            fprintf( args.output, "\n" );
-#endif
-            fragment_lengths.push_back( to - from - nambigs );
+        delete [] outs;
+    }
 
-            if ( !args.split )
-                break;
+    {
+        profile::scope_t scope( ptimes, profile::OUTPUT );
 
-            // only increment fragment identifier after printing
-            nfragment += 1;
+        for ( size_t i = 0; i < args.outputs.size(); ++i )
+            args.outputs[i]->flush();
+
+        if ( args.derep ) {
+            dedup->write( writer, *args.derep );
+            args.derep->flush();
         }
     }
 
@@ -383,12 +402,26 @@ int main( int argc, const char * argv[] )
                 args.fastq->path
                 );
 
+        if ( args.mates )
+            fprintf( stderr,
+                "\"mates\": \"%s\",\n\t"
+                "\"one mate pairs\": \"%s\",\n\t",
+                args.mates->path,
+                args.pairing == argparse::PAIR ? "pair" : args.pairing == argparse::ORPHAN ? "orphan" : "drop"
+                );
+
         fprintf( stderr,
             "\"min q-score\": %ld,\n\t"
             "\"min fragment length\": %ld,\n\t",
             args.min_qscore,
             args.min_length
         );
+
+        if ( args.window )
+            fprintf( stderr,
+                "\"q-score window\": %ld,\n\t",
+                args.window
+            );
             
         if (args.punch) {
            fprintf( stderr,
@@ -418,6 +451,34 @@ int main( int argc, const char * argv[] )
                 args.tag_mismatch
                 );
 
+        if ( args.tag_window )
+            fprintf( stderr,
+                ",\n\t\"tag search window\": %ld",
+                args.tag_window
+                );
+
+        if ( args.barcode_path )
+            fprintf( stderr,
+                ",\n\t\"barcodes\": \"%s\","
+                "\n\t\"samples\": %lu,"
+                "\n\t\"max barcode mismatches\":  %ld",
+                args.barcode_path,
+                ( unsigned long ) args.samples.size(),
+                args.tag_mismatch
+                );
+
+        if ( args.dedup )
+            fprintf( stderr,
+                ",\n\t\"dedup memory (MB)\": %ld",
+                args.dedup_memory
+                );
+
+        if ( args.derep )
+            fprintf( stderr,
+                ",\n\t\"derep\": \"%s\"",
+                args.derep_path
+                );
+
        fprintf( stderr,
             "},\n"
             "\"run summary\":{"
@@ -429,14 +490,14 @@ int main( int argc, const char * argv[] )
             "\n\t\"mean q-score\":      %g,"
             "\n\t\"contributing reads\":  %ld,"
             "\n\t\"retained fragments\":  %ld",
-            total_bases,
-            read_lengths.size(),
-            q_over10 / (double) total_bases,
-            q_over20 / (double) total_bases,
-            q_over30 / (double) total_bases,
-            q_score_sum / (double) total_bases,
-            ncontrib,
-            fragment_lengths.size()
+            counts.total_bases,
+            counts.read_lengths.count(),
+            counts.q_over10 / (double) counts.total_bases,
+            counts.q_over20 / (double) counts.total_bases,
+            counts.q_over30 / (double) counts.total_bases,
+            counts.q_score_sum / (double) counts.total_bases,
+            counts.ncontrib,
+            counts.fragment_lengths.count()
             );
     } else {
         fprintf( stderr, "run settings:\n" );
@@ -454,12 +515,26 @@ int main( int argc, const char * argv[] )
                      args.fastq->path
                    );
 
+        if ( args.mates )
+            fprintf( stderr,
+                     "    input mates:         %s\n"
+                     "    one mate pairs:      %s\n",
+                     args.mates->path,
+                     args.pairing == argparse::PAIR ? "pair" : args.pairing == argparse::ORPHAN ? "orphan" : "drop"
+                   );
+
         fprintf( stderr,
                  "    min q-score:         %ld\n"
                  "    min fragment length: %ld\n" ,
                   args.min_qscore,
                   args.min_length
                 );
+
+        if ( args.window )
+            fprintf( stderr,
+                     "    q-score window:      %ld\n",
+                     args.window
+                   );
                  
         if ( args.punch ) {
            fprintf( stderr,
@@ -488,6 +563,33 @@ int main( int argc, const char * argv[] )
                      args.tag_mismatch
                    );
 
+        if ( args.tag_window )
+            fprintf( stderr,
+                     "    tag search window:   %ld\n",
+                     args.tag_window
+                   );
+
+        if ( args.barcode_path )
+            fprintf( stderr,
+                     "    barcodes:            %s (%lu samples)\n"
+                     "    max tag mismatches:  %ld\n",
+                     args.barcode_path,
+                     ( unsigned long ) args.samples.size(),
+                     args.tag_mismatch
+                   );
+
+        if ( args.dedup )
+            fprintf( stderr,
+                     "    dedup memory:        %ld MB\n",
+                     args.dedup_memory
+                   );
+
+        if ( args.derep )
+            fprintf( stderr,
+                     "    derep output:        %s\n",
+                     args.derep_path
+                   );
+
         fprintf( stderr,
                  "\n"
                  "run summary:\n"
@@ -499,28 +601,55 @@ int main( int argc, const char * argv[] )
                  "    mean q-score      :  %g\n"
                  "    contributing reads:  %ld\n"
                  "    retained fragments:  %ld\n",
-                 total_bases,
-                 read_lengths.size(),
-                 q_over10 / (double) total_bases,
-                 q_over20 / (double) total_bases,
-                 q_over30 / (double) total_bases,
-                 q_score_sum / (double) total_bases,
-                 ncontrib,
-                 fragment_lengths.size()
+                 counts.total_bases,
+                 counts.read_lengths.count(),
+                 counts.q_over10 / (double) counts.total_bases,
+                 counts.q_over20 / (double) counts.total_bases,
+                 counts.q_over30 / (double) counts.total_bases,
+                 counts.q_score_sum / (double) counts.total_bases,
+                 counts.ncontrib,
+                 counts.fragment_lengths.count()
                );
         // print original read length and retained fragment length statistics
     }
 
-    std::sort( read_lengths.begin(), read_lengths.end() );
-    std::sort( fragment_lengths.begin(), fragment_lengths.end() );
+    fprint_length_stats( stderr, counts.read_lengths, "original read length distribution:" , args.json);
+    fprint_length_stats( stderr, counts.fragment_lengths, "retained fragment length distribution:", args.json );
 
-    fprint_vector_stats( stderr, read_lengths, "original read length distribution:" , args.json);
-    fprint_vector_stats( stderr, fragment_lengths, "retained fragment length distribution:", args.json );
+    if ( args.barcode_path )
+        fprint_samples( stderr, args, counts, args.json );
+
+    if ( args.mates )
+        fprint_pairs( stderr, args, counts, args.json );
+
+    if ( dedup )
+        fprint_dedup( stderr, args, *dedup, args.json );
+
+    if ( args.json )
+        fprintf( stderr, "\n\t}" );
+
+    if ( args.profile ) {
+        const double wall = profile::wall_time() - start_wall;
+        const size_t in = args.fastq ? args.fastq->bytes() + ( args.mates ? args.mates->bytes() : 0 )
+                                     : args.fasta->bytes() + args.qual->bytes();
+        size_t out = 0;
+
+        for ( size_t i = 0; i < args.outputs.size(); ++i )
+            out += args.outputs[i]->bytes();
+
+        if ( args.derep )
+            out += args.derep->bytes();
+
+        fprint_profile( stderr, times, wall, profile::process_cpu_time() - start_cpu,
+                        in, out, counts.read_lengths.count(), args.json );
+    }
 
     if ( args.json )
-        fprintf( stderr, "\n\t}\n}\n");
+        fprintf( stderr, "\n}\n" );
 
     delete parser;
+    delete mate_parser;
+    delete dedup;
 
     return 0;
 }
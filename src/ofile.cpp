@@ -0,0 +1,258 @@
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "common.hpp"
+#include "ofile.hpp"
+#include "profile.hpp"
+
+namespace ofile
+{
+    // buffer_t ----------------------------------------------------------------------------------------------------- //
+
+    buffer_t::buffer_t() :
+        data_( NULL ),
+        len( 0 ),
+        cap( 0 )
+    {
+    }
+
+    buffer_t::~buffer_t()
+    {
+        free( data_ );
+    }
+
+    void buffer_t::reserve( const size_t n )
+    {
+        size_t ncap = cap ? cap : 256;
+
+        if ( n <= cap )
+            return;
+
+        while ( ncap < n )
+            ncap *= 2;
+
+        // counted with -X, as buffers grow with the output
+        data_ = static_cast<char *>( profile::reallocate( data_, ncap ) );
+        __CHECK_PTR( data_ )
+        cap = ncap;
+    }
+
+    // writer_t ----------------------------------------------------------------------------------------------------- //
+
+    writer_t::writer_t( const bool fastq, const size_t width ) :
+        fastq_( fastq ),
+        width( width )
+    {
+    }
+
+    template <bool FASTQ>
+    void writer_t::header( buffer_t & out, const char * id, const size_t len, const size_t fragment ) const
+    {
+        out.put( FASTQ ? '@' : '>' );
+        out.append( id, len );
+
+        if ( fragment > 0 ) {
+            static const char tag[] = " fragment=";
+            char digits[24];
+            size_t n = fragment + 1,
+                   i = sizeof( digits );
+
+            do {
+                digits[--i] = '0' + n % 10;
+                n /= 10;
+            } while ( n );
+
+            out.append( tag, sizeof( tag ) - 1 );
+            out.append( digits + i, sizeof( digits ) - i );
+        }
+
+        out.put( '\n' );
+    }
+
+    template <bool FASTQ>
+    void writer_t::sequence( buffer_t & out, const char * seq, const size_t n, const bool wrap ) const
+    {
+        size_t i;
+
+        if ( FASTQ || !wrap || !width || n <= width ) {
+            out.append( seq, n );
+            out.put( '\n' );
+            return;
+        }
+
+        for ( i = 0; i < n; i += width ) {
+            const size_t nitem = ( n - i < width ) ? n - i : width;
+            char * dst = out.tail( nitem + 1 );
+            memcpy( dst, seq + i, nitem );
+            dst[nitem] = '\n';
+            out.grow( nitem + 1 );
+        }
+    }
+
+    template <bool FASTQ>
+    void writer_t::qualities( buffer_t & out, const unsigned char * quals, const size_t n, const unsigned char offset ) const
+    {
+        char * dst;
+        size_t i;
+
+        if ( !FASTQ )
+            return;
+
+        dst = out.tail( n + 3 );
+        dst[0] = '+';
+        dst[1] = '\n';
+
+        // encoding: chr(phred+33)
+        if ( offset == 33 )
+            memcpy( dst + 2, quals, n );
+        else
+            for ( i = 0; i < n; ++i )
+                dst[i + 2] = char( quals[i] - offset + 33 );
+
+        dst[n + 2] = '\n';
+        out.grow( n + 3 );
+    }
+
+    template void writer_t::header<false>( buffer_t &, const char *, const size_t, const size_t ) const;
+    template void writer_t::header<true>( buffer_t &, const char *, const size_t, const size_t ) const;
+    template void writer_t::sequence<false>( buffer_t &, const char *, const size_t, const bool ) const;
+    template void writer_t::sequence<true>( buffer_t &, const char *, const size_t, const bool ) const;
+    template void writer_t::qualities<false>( buffer_t &, const unsigned char *, const size_t, const unsigned char ) const;
+    template void writer_t::qualities<true>( buffer_t &, const unsigned char *, const size_t, const unsigned char ) const;
+
+    // ofile_t ------------------------------------------------------------------------------------------------------ //
+
+    ofile_t::ofile_t( const char * path ) :
+        path( path ),
+        fd( -1 ),
+        gz( NULL ),
+        nbytes( 0 )
+    {
+        const size_t len = path ? strlen( path ) : 0;
+
+        if ( !path || !strcmp( path, "-" ) )
+            fd = STDOUT_FILENO;
+        else
+            fd = open( path, O_WRONLY | O_CREAT | O_TRUNC, 0666 );
+
+        buf.reserve( OBUF_SZ );
+
+        if ( fd >= 0 && len > 3 && !strcmp( path + len - 3, ".gz" ) )
+            compress();
+    }
+
+    ofile_t::~ofile_t()
+    {
+        if ( fd >= 0 ) {
+            flush();
+
+            if ( gz ) {
+                delete gz;
+                gz = NULL;
+            }
+
+            if ( fd != STDOUT_FILENO )
+                close( fd );
+
+            fd = -1;
+        }
+    }
+
+    bool ofile_t::good() const
+    {
+        return fd >= 0;
+    }
+
+    // write both pieces with as few syscalls as possible
+    void ofile_t::write_all( const char * a, size_t alen, const char * b, size_t blen )
+    {
+        while ( alen + blen ) {
+            struct iovec iov[2];
+            int niov = 0;
+            ssize_t nbyte;
+
+            if ( alen ) {
+                iov[niov].iov_base = const_cast<char *>( a );
+                iov[niov].iov_len = alen;
+                niov += 1;
+            }
+
+            if ( blen ) {
+                iov[niov].iov_base = const_cast<char *>( b );
+                iov[niov].iov_len = blen;
+                niov += 1;
+            }
+
+            nbyte = writev( fd, iov, niov );
+
+            if ( nbyte < 0 ) {
+                if ( errno == EINTR )
+                    continue;
+
+                fprintf( stderr, "\nERROR (file: %s): write failed: %s\n", path ? path : "-", strerror( errno ) );
+                exit( 1 );
+            }
+
+            if ( size_t( nbyte ) < alen ) {
+                a += nbyte;
+                alen -= nbyte;
+            }
+            else {
+                b += nbyte - alen;
+                blen -= nbyte - alen;
+                alen = 0;
+            }
+        }
+    }
+
+    void ofile_t::compress()
+    {
+        if ( gz )
+            return;
+
+        flush();
+        gz = new gzip::deflater_t( path ? path : "-", fd );
+    }
+
+    // small writes are gathered in buf, anything that would overflow it
+    // goes out together with what buf already holds in one writev;
+    // the deflater does its own buffering
+    void ofile_t::write( const buffer_t & data )
+    {
+        nbytes += data.size();
+
+        if ( gz ) {
+            gz->write( data.data(), data.size() );
+            return;
+        }
+
+        if ( buf.size() + data.size() <= OBUF_SZ ) {
+            buf.append( data.data(), data.size() );
+            return;
+        }
+
+        write_all( buf.data(), buf.size(), data.data(), data.size() );
+        buf.clear();
+    }
+
+    size_t ofile_t::bytes() const
+    {
+        return nbytes;
+    }
+
+    void ofile_t::flush()
+    {
+        if ( gz )
+            return;
+
+        write_all( buf.data(), buf.size(), NULL, 0 );
+        buf.clear();
+    }
+}
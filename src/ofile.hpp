@@ -0,0 +1,113 @@
+
+#ifndef OFILE_H
+#define OFILE_H
+
+#include <cstddef>
+#include <cstring>
+#include <string>
+
+#include "gzip.hpp"
+
+// output is collected here and flushed in writes of at least this size
+#define OBUF_SZ ( 1 << 20 )
+
+namespace ofile
+{
+    // a growable byte buffer, appended to with memcpy and never zero-filled
+    class buffer_t
+    {
+    private:
+        char * data_;
+        size_t len;
+        size_t cap;
+
+        buffer_t( const buffer_t & );
+        buffer_t & operator=( const buffer_t & );
+
+    public:
+        buffer_t();
+        ~buffer_t();
+        void reserve( const size_t );
+
+        inline
+        char * tail( const size_t n ) {
+            if ( len + n > cap )
+                reserve( len + n );
+            return data_ + len;
+        }
+
+        inline
+        void grow( const size_t n ) {
+            len += n;
+        }
+
+        inline
+        void append( const char * str, const size_t n ) {
+            memcpy( tail( n ), str, n );
+            len += n;
+        }
+
+        inline
+        void put( const char chr ) {
+            *tail( 1 ) = chr;
+            len += 1;
+        }
+
+        inline const char * data() const { return data_; }
+        inline size_t size() const { return len; }
+        inline void clear() { len = 0; }
+        inline void resize( const size_t n ) { len = n; }
+    };
+
+    // formats records straight into a buffer_t, without going through stdio;
+    // each part is specialized on the format, FASTQ or not, which callers
+    // test once, through fastq(), rather than once per record
+    class writer_t
+    {
+    private:
+        const bool fastq_;
+        const size_t width;
+
+    public:
+        writer_t( const bool fastq, const size_t width );
+        inline bool fastq() const { return fastq_; }
+        // the ID line, with a " fragment=N" suffix for any fragment after the first
+        template <bool FASTQ>
+        void header( buffer_t &, const char * id, const size_t len, const size_t fragment=0 ) const;
+        // sequence lines, wrapped at width for FASTA (unless width is 0 or wrap is false)
+        template <bool FASTQ>
+        void sequence( buffer_t &, const char *, const size_t, const bool wrap=true ) const;
+        // for FASTQ, the separator and the phred+33 encoded scores,
+        // given as raw bytes less offset; phred+33 bytes are copied straight through
+        template <bool FASTQ>
+        void qualities( buffer_t &, const unsigned char *, const size_t, const unsigned char offset=0 ) const;
+    };
+
+    class ofile_t
+    {
+    public:
+        const char * const path;
+
+    private:
+        int fd;
+        buffer_t buf;
+        // BGZF compression, when enabled
+        gzip::deflater_t * gz;
+        // bytes written, before any compression
+        size_t nbytes;
+
+        void write_all( const char *, size_t, const char *, size_t );
+
+    public:
+        ofile_t( const char * path=NULL );
+        ~ofile_t();
+        bool good() const;
+        // compress everything written from here on as BGZF
+        void compress();
+        void write( const buffer_t & );
+        void flush();
+        size_t bytes() const;
+    };
+}
+
+#endif // OFILE_H
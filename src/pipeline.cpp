@@ -0,0 +1,342 @@
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <thread>
+#include <vector>
+
+#include "pipeline.hpp"
+#include "queue.hpp"
+
+namespace pipeline
+{
+    class batch_t
+    {
+    public:
+        size_t index;
+        size_t nread;
+        std::vector<seq::seq_t> reads;
+        // the reads' fields that aren't views of a mapping
+        seq::arena_t arena;
+        filter::fragments_t frags;
+        // for paired-end reads, the same for their mates
+        std::vector<seq::seq_t> mates;
+        seq::arena_t mate_arena;
+        filter::fragments_t mate_frags;
+        // for dedup, the fingerprint of each fragment
+        std::vector<uint64_t> prints;
+        // formatted fragments, for each output
+        ofile::buffer_t * outs;
+
+        batch_t() :
+            index( 0 ),
+            nread( 0 ),
+            reads( BATCH_SZ ),
+            outs( NULL )
+        {
+        }
+
+        ~batch_t()
+        {
+            delete [] outs;
+        }
+    };
+
+    static
+    void read( seq::parser_t & parser, queue_t<batch_t *> & free_q, queue_t<batch_t *> & work_q, profile::times_t * times )
+    {
+        size_t index = 0;
+        bool more = true;
+
+        while ( more ) {
+            batch_t * batch = NULL;
+
+            free_q.pop( batch );
+
+            {
+                profile::scope_t scope( times, profile::PARSE );
+
+                batch->arena.reset();
+
+                for ( batch->nread = 0; batch->nread < BATCH_SZ; ++batch->nread ) {
+                    seq::seq_t & seq = batch->reads[batch->nread];
+
+                    seq.clear();
+
+                    if ( !parser.next( seq, batch->arena ) ) {
+                        more = false;
+                        break;
+                    }
+                }
+            }
+
+            batch->index = index++;
+            work_q.push( batch );
+        }
+
+        work_q.close();
+    }
+
+    // the mates of each batch of reads, as many as there are reads
+    static
+    void read_mates( seq::parser_t & parser, queue_t<batch_t *> & mate_q, queue_t<batch_t *> & work_q, profile::times_t * times )
+    {
+        batch_t * batch = NULL;
+        seq::arena_t arena;
+        seq::seq_t seq;
+        size_t nread;
+
+        while ( mate_q.pop( batch ) ) {
+            {
+                profile::scope_t scope( times, profile::PARSE );
+
+                batch->mate_arena.reset();
+
+                if ( batch->mates.size() < BATCH_SZ )
+                    batch->mates.resize( BATCH_SZ );
+
+                for ( nread = 0; nread < batch->nread; ++nread ) {
+                    const seq::seq_t & read = batch->reads[nread],
+                                     & mate = batch->mates[nread];
+
+                    batch->mates[nread].clear();
+
+                    if ( !parser.next( batch->mates[nread], batch->mate_arena ) )
+                        break;
+
+                    // a read skipped as malformed has no ID left to compare
+                    if ( read.id.length() && mate.id.length() && !seq::same_mates( read.id, mate.id ) ) {
+                        fprintf(
+                            stderr,
+                            "\nERROR: the -Q and -2 FASTQ files are out of step: read %.*s is paired with %.*s\n",
+                            int( read.id.length() ),
+                            read.id.data(),
+                            int( mate.id.length() ),
+                            mate.id.data()
+                            );
+                        exit( 1 );
+                    }
+                }
+            }
+
+            if ( nread < batch->nread ) {
+                fprintf( stderr, "\nERROR: the -2 FASTQ file has fewer reads than the -Q FASTQ file\n" );
+                exit( 1 );
+            }
+
+            work_q.push( batch );
+        }
+
+        if ( parser.next( seq, arena ) ) {
+            fprintf( stderr, "\nERROR: the -2 FASTQ file has more reads than the -Q FASTQ file\n" );
+            exit( 1 );
+        }
+
+        work_q.close();
+    }
+
+    static
+    void work(
+        const filter::filter_t & filter,
+        const filter::filter_t * mate_filter,
+        const argparse::pairing_t pairing,
+        const bool deduping,
+        const ofile::writer_t & writer,
+        const size_t noutput,
+        filter::counts_t & counts,
+        queue_t<batch_t *> & work_q,
+        queue_t<batch_t *> & done_q,
+        std::atomic<size_t> & nrunning,
+        profile::times_t * times
+        )
+    {
+        batch_t * batch = NULL;
+        size_t i;
+
+        while ( work_q.pop( batch ) ) {
+            batch->frags.clear();
+
+            for ( i = 0; i < noutput; ++i )
+                batch->outs[i].clear();
+
+            filter.filter_batch( &batch->reads[0], batch->nread, counts, batch->frags, times );
+
+            if ( mate_filter ) {
+                batch->mate_frags.clear();
+                mate_filter->filter_batch( &batch->mates[0], batch->nread, counts, batch->mate_frags, times );
+            }
+
+            // duplicates are dropped, and the rest formatted, in order, by the writer
+            if ( deduping ) {
+                profile::scope_t scope( times, profile::DEDUP );
+                dedup::fingerprints( &batch->reads[0], batch->frags, batch->prints );
+            }
+            else {
+                profile::scope_t scope( times, profile::OUTPUT );
+
+                if ( mate_filter )
+                    filter::format_pairs( writer, pairing, filter.tagged(), &batch->reads[0], batch->frags, &batch->mates[0], batch->mate_frags, batch->nread, batch->outs, counts );
+                else
+                    filter::format( writer, &batch->reads[0], batch->frags, batch->outs );
+            }
+
+            done_q.push( batch );
+        }
+
+        // the last worker out tells the writer there is nothing more to come
+        if ( --nrunning == 0 )
+            done_q.close();
+    }
+
+    // with mates, the reader hands each batch to a second reader for its mates,
+    // so the two files are parsed side by side
+    static
+    void execute(
+        seq::parser_t & parser,
+        seq::parser_t * mates,
+        const filter::filter_t & filter,
+        const filter::filter_t * mate_filter,
+        const argparse::pairing_t pairing,
+        const ofile::writer_t & writer,
+        const std::vector<ofile::ofile_t *> & outputs,
+        filter::counts_t & counts,
+        const size_t nthreads,
+        profile::times_t * times,
+        dedup::dedup_t * dedup
+        )
+    {
+        // enough batches in flight to keep every worker busy
+        // while the reader and writer are working on others
+        const size_t nbatch = 2 * nthreads + 2;
+        std::vector<batch_t> batches( nbatch );
+        std::vector<filter::counts_t> thread_counts( nthreads );
+        // each thread keeps its own times, merged into times at the end
+        std::vector<profile::times_t> thread_times( nthreads + 2 );
+        std::vector<std::thread> workers;
+        std::map<size_t, batch_t *> pending;
+        std::atomic<size_t> nrunning( nthreads );
+        queue_t<batch_t *> free_q( nbatch ),
+                           mate_q( nbatch ),
+                           work_q( nbatch ),
+                           done_q( nbatch );
+        batch_t * batch = NULL;
+        size_t next = 0,
+               i;
+
+        for ( i = 0; i < nbatch; ++i ) {
+            batches[i].outs = new ofile::buffer_t[outputs.size()];
+            free_q.push( &batches[i] );
+        }
+
+        std::thread reader(
+            read,
+            std::ref( parser ),
+            std::ref( free_q ),
+            std::ref( mates ? mate_q : work_q ),
+            times ? &thread_times[nthreads] : NULL
+            );
+        std::thread mate_reader;
+
+        if ( mates )
+            mate_reader = std::thread(
+                read_mates,
+                std::ref( *mates ),
+                std::ref( mate_q ),
+                std::ref( work_q ),
+                times ? &thread_times[nthreads + 1] : NULL
+                );
+
+        for ( i = 0; i < nthreads; ++i )
+            workers.push_back( std::thread(
+                work,
+                std::cref( filter ),
+                mate_filter,
+                pairing,
+                dedup != NULL,
+                std::cref( writer ),
+                outputs.size(),
+                std::ref( thread_counts[i] ),
+                std::ref( work_q ),
+                std::ref( done_q ),
+                std::ref( nrunning ),
+                times ? &thread_times[i] : NULL
+                ) );
+
+        // batches finish out of order, so hold on to them
+        // until the next one in line is done
+        while ( done_q.pop( batch ) ) {
+            pending[batch->index] = batch;
+
+            while ( !pending.empty() && pending.begin()->first == next ) {
+                batch = pending.begin()->second;
+                pending.erase( pending.begin() );
+
+                if ( dedup ) {
+                    {
+                        profile::scope_t scope( times, profile::DEDUP );
+                        dedup->filter( &batch->reads[0], batch->frags, batch->prints );
+                        filter.count( batch->frags, 0, counts );
+                    }
+
+                    profile::scope_t scope( times, profile::OUTPUT );
+                    filter::format( writer, &batch->reads[0], batch->frags, batch->outs );
+                }
+
+                {
+                    profile::scope_t scope( times, profile::OUTPUT );
+
+                    for ( i = 0; i < outputs.size(); ++i )
+                        outputs[i]->write( batch->outs[i] );
+                }
+
+                free_q.push( batch );
+                next += 1;
+            }
+        }
+
+        reader.join();
+
+        if ( mates )
+            mate_reader.join();
+
+        for ( i = 0; i < nthreads; ++i ) {
+            workers[i].join();
+            counts.merge( thread_counts[i] );
+        }
+
+        if ( times )
+            for ( i = 0; i < thread_times.size(); ++i )
+                times->merge( thread_times[i] );
+    }
+
+    void run(
+        seq::parser_t & parser,
+        const filter::filter_t & filter,
+        const ofile::writer_t & writer,
+        const std::vector<ofile::ofile_t *> & outputs,
+        filter::counts_t & counts,
+        const size_t nthreads,
+        profile::times_t * times,
+        dedup::dedup_t * dedup
+        )
+    {
+        execute( parser, NULL, filter, NULL, argparse::ORPHAN, writer, outputs, counts, nthreads, times, dedup );
+    }
+
+    void run(
+        seq::parser_t & parser,
+        seq::parser_t & mates,
+        const filter::filter_t & filter,
+        const filter::filter_t & mate_filter,
+        const argparse::pairing_t pairing,
+        const ofile::writer_t & writer,
+        const std::vector<ofile::ofile_t *> & outputs,
+        filter::counts_t & counts,
+        const size_t nthreads,
+        profile::times_t * times
+        )
+    {
+        execute( parser, &mates, filter, &mate_filter, pairing, writer, outputs, counts, nthreads, times, NULL );
+    }
+}
@@ -0,0 +1,53 @@
+
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <cstdio>
+#include <vector>
+
+#include "dedup.hpp"
+#include "filter.hpp"
+#include "ofile.hpp"
+#include "profile.hpp"
+#include "seq.hpp"
+
+// reads handed to a worker at a time
+#define BATCH_SZ 1024
+
+namespace pipeline
+{
+    // parse on one thread, filter batches of reads on nthreads workers,
+    // and write each batch's fragments in input order on the calling thread,
+    // each to the output of its sample (the only output, if not demultiplexing),
+    // charging the time spent in each stage to times, if given; with dedup,
+    // the workers fingerprint the fragments, and the calling thread drops
+    // the duplicates, in input order, and formats the rest itself
+    void run(
+        seq::parser_t &,
+        const filter::filter_t &,
+        const ofile::writer_t &,
+        const std::vector<ofile::ofile_t *> & outputs,
+        filter::counts_t &,
+        const size_t nthreads,
+        profile::times_t * times=NULL,
+        dedup::dedup_t * dedup=NULL
+        );
+
+    // the same for paired-end reads: the mates are parsed on a thread of their
+    // own, alongside the reads, and filtered by mate_filter, and each batch's
+    // pairs are written to outputs 0 and 1, and any singletons to output 2
+    void run(
+        seq::parser_t &,
+        seq::parser_t & mates,
+        const filter::filter_t &,
+        const filter::filter_t & mate_filter,
+        const argparse::pairing_t,
+        const ofile::writer_t &,
+        const std::vector<ofile::ofile_t *> & outputs,
+        filter::counts_t &,
+        const size_t nthreads,
+        profile::times_t * times=NULL
+        );
+}
+
+#endif // PIPELINE_H
@@ -0,0 +1,144 @@
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+#include <sys/resource.h>
+#include <time.h>
+
+#include "profile.hpp"
+
+namespace profile
+{
+    const char * const stage_names[NSTAGE] = { "parse", "stats", "filter", "dedup", "output" };
+
+    // set once, before any threads are started
+    static bool counting = false;
+    static std::atomic<size_t> nalloc( 0 );
+    static std::atomic<size_t> nalloc_bytes( 0 );
+
+    times_t::times_t()
+    {
+        size_t i;
+
+        for ( i = 0; i < NSTAGE; ++i ) {
+            wall[i] = 0.;
+            cpu[i] = 0.;
+        }
+    }
+
+    void times_t::merge( const times_t & other )
+    {
+        size_t i;
+
+        for ( i = 0; i < NSTAGE; ++i ) {
+            wall[i] += other.wall[i];
+            cpu[i] += other.cpu[i];
+        }
+    }
+
+    static inline
+    double seconds( const clockid_t clock )
+    {
+        struct timespec ts;
+
+        clock_gettime( clock, &ts );
+
+        return ts.tv_sec + 1e-9 * ts.tv_nsec;
+    }
+
+    double wall_time()
+    {
+        return seconds( CLOCK_MONOTONIC );
+    }
+
+    double thread_cpu_time()
+    {
+        return seconds( CLOCK_THREAD_CPUTIME_ID );
+    }
+
+    double process_cpu_time()
+    {
+        struct rusage ru;
+
+        getrusage( RUSAGE_SELF, &ru );
+
+        return ru.ru_utime.tv_sec + 1e-6 * ru.ru_utime.tv_usec
+               + ru.ru_stime.tv_sec + 1e-6 * ru.ru_stime.tv_usec;
+    }
+
+    long peak_rss()
+    {
+        struct rusage ru;
+
+        getrusage( RUSAGE_SELF, &ru );
+
+        return ru.ru_maxrss;
+    }
+
+    scope_t::scope_t( times_t * times, const stage_t stage ) :
+        times( times ),
+        stage( stage ),
+        wall( 0. ),
+        cpu( 0. )
+    {
+        if ( times ) {
+            wall = wall_time();
+            cpu = thread_cpu_time();
+        }
+    }
+
+    scope_t::~scope_t()
+    {
+        if ( times ) {
+            times->wall[stage] += wall_time() - wall;
+            times->cpu[stage] += thread_cpu_time() - cpu;
+        }
+    }
+
+    void count_allocations()
+    {
+        counting = true;
+    }
+
+    size_t allocations()
+    {
+        return nalloc.load();
+    }
+
+    size_t allocated_bytes()
+    {
+        return nalloc_bytes.load();
+    }
+
+    static inline
+    void counted( const size_t n )
+    {
+        if ( counting ) {
+            nalloc.fetch_add( 1, std::memory_order_relaxed );
+            nalloc_bytes.fetch_add( n, std::memory_order_relaxed );
+        }
+    }
+
+    void * allocate( const size_t n )
+    {
+        void * ptr = malloc( n ? n : 1 );
+
+        if ( !ptr )
+            throw std::bad_alloc();
+
+        counted( n );
+
+        return ptr;
+    }
+
+    void * reallocate( void * ptr, const size_t n )
+    {
+        ptr = realloc( ptr, n );
+
+        if ( ptr )
+            counted( n );
+
+        return ptr;
+    }
+}
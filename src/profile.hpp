@@ -0,0 +1,67 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <cstddef>
+
+namespace profile
+{
+    enum stage_t {
+        PARSE,
+        STATS,
+        FILTER,
+        DEDUP,
+        OUTPUT,
+        NSTAGE
+    };
+
+    extern const char * const stage_names[NSTAGE];
+
+    // wall and CPU seconds spent in each stage, summed over the threads running it
+    class times_t
+    {
+    public:
+        double wall[NSTAGE];
+        double cpu[NSTAGE];
+
+        times_t();
+        void merge( const times_t & );
+    };
+
+    double wall_time();
+    double thread_cpu_time();
+    // user and system time of the whole process
+    double process_cpu_time();
+    // peak resident set size, in kilobytes
+    long peak_rss();
+
+    // charge the time until the end of its scope to a stage,
+    // or do nothing at all if there are no times to charge it to
+    class scope_t
+    {
+    private:
+        times_t * const times;
+        const stage_t stage;
+        double wall;
+        double cpu;
+
+        scope_t( const scope_t & );
+        scope_t & operator=( const scope_t & );
+
+    public:
+        scope_t( times_t *, const stage_t );
+        ~scope_t();
+    };
+
+    // count calls to operator new from here on; only an executable that
+    // links in alloc.cpp, which replaces operator new, has any to count
+    void count_allocations();
+    size_t allocations();
+    size_t allocated_bytes();
+    // malloc, counted once count_allocations() is called
+    void * allocate( const size_t );
+    // realloc, counted as a new allocation of n bytes, as for ofile::buffer_t,
+    // which grows outside operator new; NULL if it fails
+    void * reallocate( void *, const size_t n );
+}
+
+#endif // PROFILE_H
@@ -0,0 +1,323 @@
+
+#include "qscan.hpp"
+
+#if defined( __GNUC__ ) && ( defined( __x86_64__ ) || defined( __i386__ ) ) && defined( __SSE2__ )
+#define QSCAN_X86 1
+#include <immintrin.h>
+#endif
+
+namespace qscan
+{
+    // scalar ----------------------------------------------------------------------------------------------------- //
+
+    static
+    size_t find_below_scalar( const unsigned char * q, size_t from, size_t to, unsigned char t )
+    {
+        while ( from < to && q[from] >= t )
+            ++from;
+
+        return from;
+    }
+
+    static
+    size_t find_at_least_scalar( const unsigned char * q, size_t from, size_t to, unsigned char t )
+    {
+        while ( from < to && q[from] < t )
+            ++from;
+
+        return from;
+    }
+
+    static
+    void tally_scalar( const unsigned char * q, size_t n, totals_t & tot, unsigned char off )
+    {
+        size_t i;
+
+        for ( i = 0; i < n; ++i ) {
+            const unsigned v = ( q[i] > off ) ? q[i] - off : 0;
+            tot.sum += v;
+            tot.over10 += ( v >= 10 );
+            tot.over20 += ( v >= 20 );
+            tot.over30 += ( v >= 30 );
+        }
+    }
+
+#ifdef QSCAN_X86
+
+    // SSE2 ------------------------------------------------------------------------------------------------------- //
+
+    // there is no unsigned byte compare, but max(x, t) == x iff x >= t;
+    // the movemask then has a bit set for every score at or above t
+
+    static
+    size_t find_below_sse2( const unsigned char * q, size_t from, size_t to, unsigned char t )
+    {
+        const __m128i vt = _mm_set1_epi8( char( t ) );
+
+        for ( ; from + 16 <= to; from += 16 ) {
+            const __m128i x = _mm_loadu_si128( reinterpret_cast<const __m128i *>( q + from ) );
+            const unsigned mask = ~unsigned( _mm_movemask_epi8( _mm_cmpeq_epi8( _mm_max_epu8( x, vt ), x ) ) ) & 0xFFFFu;
+
+            if ( mask )
+                return from + __builtin_ctz( mask );
+        }
+
+        return find_below_scalar( q, from, to, t );
+    }
+
+    static
+    size_t find_at_least_sse2( const unsigned char * q, size_t from, size_t to, unsigned char t )
+    {
+        const __m128i vt = _mm_set1_epi8( char( t ) );
+
+        for ( ; from + 16 <= to; from += 16 ) {
+            const __m128i x = _mm_loadu_si128( reinterpret_cast<const __m128i *>( q + from ) );
+            const unsigned mask = unsigned( _mm_movemask_epi8( _mm_cmpeq_epi8( _mm_max_epu8( x, vt ), x ) ) );
+
+            if ( mask )
+                return from + __builtin_ctz( mask );
+        }
+
+        return find_at_least_scalar( q, from, to, t );
+    }
+
+    static inline
+    unsigned long hsum_sse2( const __m128i x )
+    {
+        unsigned long long lanes[2];
+        _mm_storeu_si128( reinterpret_cast<__m128i *>( lanes ), x );
+        return lanes[0] + lanes[1];
+    }
+
+    // scores are raw bytes less off, clamped at 0: max(x, off) does the clamping,
+    // and a sad against off then adds the 16 scores into two 64-bit lanes;
+    // the threshold tests become 0/1 bytes so they can be summed against zero.
+    // The thresholds are moved up by off, and so must stay below 256
+    static
+    void tally_sse2( const unsigned char * q, size_t n, totals_t & tot, unsigned char off )
+    {
+        const __m128i zero = _mm_setzero_si128(),
+                      one = _mm_set1_epi8( 1 ),
+                      voff = _mm_set1_epi8( char( off ) ),
+                      t10 = _mm_set1_epi8( char( 10 + off ) ),
+                      t20 = _mm_set1_epi8( char( 20 + off ) ),
+                      t30 = _mm_set1_epi8( char( 30 + off ) );
+        __m128i sum = zero,
+                c10 = zero,
+                c20 = zero,
+                c30 = zero;
+        size_t i;
+
+        for ( i = 0; i + 16 <= n; i += 16 ) {
+            const __m128i x = _mm_max_epu8( _mm_loadu_si128( reinterpret_cast<const __m128i *>( q + i ) ), voff );
+            sum = _mm_add_epi64( sum, _mm_sad_epu8( x, voff ) );
+            c10 = _mm_add_epi64( c10, _mm_sad_epu8( _mm_and_si128( _mm_cmpeq_epi8( _mm_max_epu8( x, t10 ), x ), one ), zero ) );
+            c20 = _mm_add_epi64( c20, _mm_sad_epu8( _mm_and_si128( _mm_cmpeq_epi8( _mm_max_epu8( x, t20 ), x ), one ), zero ) );
+            c30 = _mm_add_epi64( c30, _mm_sad_epu8( _mm_and_si128( _mm_cmpeq_epi8( _mm_max_epu8( x, t30 ), x ), one ), zero ) );
+        }
+
+        tot.sum += hsum_sse2( sum );
+        tot.over10 += hsum_sse2( c10 );
+        tot.over20 += hsum_sse2( c20 );
+        tot.over30 += hsum_sse2( c30 );
+
+        tally_scalar( q + i, n - i, tot, off );
+    }
+
+    // AVX2 ------------------------------------------------------------------------------------------------------- //
+
+    static
+    __attribute__(( target( "avx2" ) ))
+    size_t find_below_avx2( const unsigned char * q, size_t from, size_t to, unsigned char t )
+    {
+        const __m256i vt = _mm256_set1_epi8( char( t ) );
+
+        for ( ; from + 32 <= to; from += 32 ) {
+            const __m256i x = _mm256_loadu_si256( reinterpret_cast<const __m256i *>( q + from ) );
+            const unsigned mask = ~unsigned( _mm256_movemask_epi8( _mm256_cmpeq_epi8( _mm256_max_epu8( x, vt ), x ) ) );
+
+            if ( mask )
+                return from + __builtin_ctz( mask );
+        }
+
+        return find_below_sse2( q, from, to, t );
+    }
+
+    static
+    __attribute__(( target( "avx2" ) ))
+    size_t find_at_least_avx2( const unsigned char * q, size_t from, size_t to, unsigned char t )
+    {
+        const __m256i vt = _mm256_set1_epi8( char( t ) );
+
+        for ( ; from + 32 <= to; from += 32 ) {
+            const __m256i x = _mm256_loadu_si256( reinterpret_cast<const __m256i *>( q + from ) );
+            const unsigned mask = unsigned( _mm256_movemask_epi8( _mm256_cmpeq_epi8( _mm256_max_epu8( x, vt ), x ) ) );
+
+            if ( mask )
+                return from + __builtin_ctz( mask );
+        }
+
+        return find_at_least_sse2( q, from, to, t );
+    }
+
+    static inline
+    __attribute__(( target( "avx2" ) ))
+    unsigned long hsum_avx2( const __m256i x )
+    {
+        return hsum_sse2( _mm_add_epi64( _mm256_castsi256_si128( x ), _mm256_extracti128_si256( x, 1 ) ) );
+    }
+
+    static
+    __attribute__(( target( "avx2" ) ))
+    void tally_avx2( const unsigned char * q, size_t n, totals_t & tot, unsigned char off )
+    {
+        const __m256i zero = _mm256_setzero_si256(),
+                      one = _mm256_set1_epi8( 1 ),
+                      voff = _mm256_set1_epi8( char( off ) ),
+                      t10 = _mm256_set1_epi8( char( 10 + off ) ),
+                      t20 = _mm256_set1_epi8( char( 20 + off ) ),
+                      t30 = _mm256_set1_epi8( char( 30 + off ) );
+        __m256i sum = zero,
+                c10 = zero,
+                c20 = zero,
+                c30 = zero;
+        size_t i;
+
+        for ( i = 0; i + 32 <= n; i += 32 ) {
+            const __m256i x = _mm256_max_epu8( _mm256_loadu_si256( reinterpret_cast<const __m256i *>( q + i ) ), voff );
+            sum = _mm256_add_epi64( sum, _mm256_sad_epu8( x, voff ) );
+            c10 = _mm256_add_epi64( c10, _mm256_sad_epu8( _mm256_and_si256( _mm256_cmpeq_epi8( _mm256_max_epu8( x, t10 ), x ), one ), zero ) );
+            c20 = _mm256_add_epi64( c20, _mm256_sad_epu8( _mm256_and_si256( _mm256_cmpeq_epi8( _mm256_max_epu8( x, t20 ), x ), one ), zero ) );
+            c30 = _mm256_add_epi64( c30, _mm256_sad_epu8( _mm256_and_si256( _mm256_cmpeq_epi8( _mm256_max_epu8( x, t30 ), x ), one ), zero ) );
+        }
+
+        tot.sum += hsum_avx2( sum );
+        tot.over10 += hsum_avx2( c10 );
+        tot.over20 += hsum_avx2( c20 );
+        tot.over30 += hsum_avx2( c30 );
+
+        tally_sse2( q + i, n - i, tot, off );
+    }
+
+#endif // QSCAN_X86
+
+    // dispatch --------------------------------------------------------------------------------------------------- //
+
+    class kernels_t
+    {
+    public:
+        size_t ( * find_below )( const unsigned char *, size_t, size_t, unsigned char );
+        size_t ( * find_at_least )( const unsigned char *, size_t, size_t, unsigned char );
+        void ( * tally )( const unsigned char *, size_t, totals_t &, unsigned char );
+        const char * name;
+
+        // pick the widest kernel the CPU supports, once, at startup
+        kernels_t() :
+            find_below( find_below_scalar ),
+            find_at_least( find_at_least_scalar ),
+            tally( tally_scalar ),
+            name( "scalar" )
+        {
+#ifdef QSCAN_X86
+            __builtin_cpu_init();
+
+            if ( __builtin_cpu_supports( "avx2" ) ) {
+                find_below = find_below_avx2;
+                find_at_least = find_at_least_avx2;
+                tally = tally_avx2;
+                name = "avx2";
+            }
+            else {
+                find_below = find_below_sse2;
+                find_at_least = find_at_least_sse2;
+                tally = tally_sse2;
+                name = "sse2";
+            }
+#endif
+        }
+    };
+
+    static const kernels_t kernels;
+
+    // thresholds above the largest score are settled without scanning,
+    // as is a threshold of 0, which every score meets, even those clamped from below off
+
+    size_t find_below( const unsigned char * q, size_t from, size_t to, size_t thresh, unsigned char off )
+    {
+        if ( !thresh )
+            return ( from < to ) ? to : from;
+
+        thresh += off;
+
+        if ( thresh > 255 )
+            return ( from < to ) ? from : to;
+
+        return kernels.find_below( q, from, to, thresh );
+    }
+
+    size_t find_at_least( const unsigned char * q, size_t from, size_t to, size_t thresh, unsigned char off )
+    {
+        if ( !thresh )
+            return from;
+
+        thresh += off;
+
+        if ( thresh > 255 )
+            return ( from < to ) ? to : from;
+
+        return kernels.find_at_least( q, from, to, thresh );
+    }
+
+    void tally( const unsigned char * q, size_t n, totals_t & tot, unsigned char off )
+    {
+        if ( off > 255 - 30 )
+            tally_scalar( q, n, tot, off );
+        else
+            kernels.tally( q, n, tot, off );
+    }
+
+    static inline
+    size_t score( const unsigned char x, unsigned char off )
+    {
+        return ( x > off ) ? x - off : 0;
+    }
+
+    static inline
+    size_t find_window( const unsigned char * q, size_t from, size_t to, size_t w, size_t thresh, unsigned char off, bool good )
+    {
+        const size_t min_sum = thresh * w;
+        size_t sum = 0,
+               i;
+
+        if ( from >= to )
+            return to;
+
+        for ( i = from; i < from + w; ++i )
+            sum += score( q[i], off );
+
+        for ( i = from; ( sum >= min_sum ) != good; ++i ) {
+            if ( i + 1 >= to )
+                return to;
+
+            sum += score( q[i + w], off );
+            sum -= score( q[i], off );
+        }
+
+        return i;
+    }
+
+    size_t find_window_at_least( const unsigned char * q, size_t from, size_t to, size_t w, size_t thresh, unsigned char off )
+    {
+        return find_window( q, from, to, w, thresh, off, true );
+    }
+
+    size_t find_window_below( const unsigned char * q, size_t from, size_t to, size_t w, size_t thresh, unsigned char off )
+    {
+        return find_window( q, from, to, w, thresh, off, false );
+    }
+
+    const char * kernel()
+    {
+        return kernels.name;
+    }
+}
@@ -0,0 +1,49 @@
+
+#ifndef QSCAN_H
+#define QSCAN_H
+
+#include <cstddef>
+
+// quality-score scanning kernels, vectorized with SSE2 or AVX2
+// (whichever the CPU running the binary supports), with a scalar fallback.
+// Scores may be given raw, as bytes less an offset off (33 for FASTQ),
+// with bytes below off taken as a score of 0
+namespace qscan
+{
+    class totals_t
+    {
+    public:
+        unsigned long sum;
+        unsigned long over10;
+        unsigned long over20;
+        unsigned long over30;
+
+        totals_t() :
+            sum( 0UL ),
+            over10( 0UL ),
+            over20( 0UL ),
+            over30( 0UL )
+        {
+        }
+    };
+
+    // index of the first score in [from, to) below thresh, or to if there is none
+    size_t find_below( const unsigned char *, size_t from, size_t to, size_t thresh, unsigned char off=0 );
+
+    // index of the first score in [from, to) at or above thresh, or to if there is none
+    size_t find_at_least( const unsigned char *, size_t from, size_t to, size_t thresh, unsigned char off=0 );
+
+    // the start of the first window of w scores, of those starting in [from, to),
+    // whose sum is at least (or below) thresh * w, or to if there is none;
+    // the windows must lie within q, and the sum rolls, so each step is O(1)
+    size_t find_window_at_least( const unsigned char *, size_t from, size_t to, size_t w, size_t thresh, unsigned char off=0 );
+    size_t find_window_below( const unsigned char *, size_t from, size_t to, size_t w, size_t thresh, unsigned char off=0 );
+
+    // add the sum of n scores and the number of them at or above 10, 20 and 30
+    void tally( const unsigned char *, size_t n, totals_t &, unsigned char off=0 );
+
+    // name of the kernel chosen for this CPU: "avx2", "sse2" or "scalar"
+    const char * kernel();
+}
+
+#endif // QSCAN_H
@@ -0,0 +1,73 @@
+
+#ifndef QUEUE_H
+#define QUEUE_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+
+// a bounded, blocking FIFO shared between threads;
+// once closed, push() is refused and pop() drains what is left, then returns false
+template <typename T>
+class queue_t
+{
+private:
+    std::deque<T> items;
+    const size_t capacity;
+    bool closed;
+    std::mutex lock;
+    std::condition_variable not_empty;
+    std::condition_variable not_full;
+
+public:
+    queue_t( const size_t capacity ) :
+        capacity( capacity ),
+        closed( false )
+    {
+    }
+
+    // false, without pushing, if the queue has been closed
+    bool push( const T & item )
+    {
+        std::unique_lock<std::mutex> guard( lock );
+
+        while ( items.size() >= capacity && !closed )
+            not_full.wait( guard );
+
+        if ( closed )
+            return false;
+
+        items.push_back( item );
+        not_empty.notify_one();
+
+        return true;
+    }
+
+    bool pop( T & item )
+    {
+        std::unique_lock<std::mutex> guard( lock );
+
+        while ( items.empty() && !closed )
+            not_empty.wait( guard );
+
+        if ( items.empty() )
+            return false;
+
+        item = items.front();
+        items.pop_front();
+        not_full.notify_one();
+
+        return true;
+    }
+
+    void close()
+    {
+        std::lock_guard<std::mutex> guard( lock );
+        closed = true;
+        not_empty.notify_all();
+        not_full.notify_all();
+    }
+};
+
+#endif // QUEUE_H
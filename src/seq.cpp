@@ -1,7 +1,11 @@
+#include <condition_variable>
+#include <cstring>
+#include <mutex>
+#include <thread>
 
 #include "common.hpp"
+#include "queue.hpp"
 #include "seq.hpp"
-#include "strtok.hpp"
 
 // helper classes and functions
 
@@ -15,7 +19,52 @@
 
 namespace seq
 {
-    seq_t::seq_t() : length( 0 ) { }
+    // arena_t ---------------------------------------------------------------------------------------------------- //
+
+    arena_t::arena_t() :
+        block( 0 ),
+        used( 0 )
+    {
+    }
+
+    arena_t::~arena_t()
+    {
+        size_t i;
+
+        for ( i = 0; i < blocks.size(); ++i )
+            delete [] blocks[i].first;
+    }
+
+    char * arena_t::alloc( const size_t n )
+    {
+        char * p;
+
+        // move on past any blocks too small for n, this time round
+        while ( block < blocks.size() && blocks[block].second - used < n ) {
+            block += 1;
+            used = 0;
+        }
+
+        if ( block == blocks.size() ) {
+            const size_t sz = ( n > ARENA_BLOCK_SZ ) ? n : ARENA_BLOCK_SZ;
+            blocks.push_back( std::make_pair( new char[sz], sz ) );
+        }
+
+        p = blocks[block].first + used;
+        used += n;
+
+        return p;
+    }
+
+    void arena_t::reset()
+    {
+        block = 0;
+        used = 0;
+    }
+
+    // seq_t ------------------------------------------------------------------------------------------------------ //
+
+    seq_t::seq_t() : offset( 0 ), length( 0 ) { }
 
     void seq_t::clear()
     {
@@ -25,17 +74,445 @@ namespace seq
         length = 0;
     }
 
+    void seq_t::keep( arena_t & arena )
+    {
+        id.keep( arena );
+        seq.keep( arena );
+        quals.keep( arena );
+    }
+
+    // reader_t --------------------------------------------------------------------------------------------------- //
+
+    class batch_t
+    {
+    public:
+        std::vector<seq_t> recs;
+        // where each record ends, as the file is read on past it
+        std::vector<ifile::mark_t> marks;
+        size_t nrec;
+        arena_t arena;
+
+        batch_t() :
+            recs( READ_BATCH_SZ ),
+            marks( READ_BATCH_SZ ),
+            nrec( 0 )
+        {
+        }
+    };
+
+    // runs parser_t::parse over a single file on its own thread,
+    // passing batches of records through a bounded queue
+    class reader_t
+    {
+    private:
+        static const size_t nbatch = 4;
+
+        parser_t & parser;
+        ifile::ifile_t * const file;
+        const filetype_t filetype;
+        state_t state;
+        scratch_t scratch;
+        batch_t batches[nbatch];
+        queue_t<batch_t *> free_q;
+        queue_t<batch_t *> full_q;
+        batch_t * curr;
+        size_t pos;
+        std::thread thread;
+
+        void run()
+        {
+            batch_t * batch = NULL;
+            bool more = true;
+
+            while ( more && free_q.pop( batch ) ) {
+                batch->arena.reset();
+
+                for ( batch->nrec = 0; batch->nrec < READ_BATCH_SZ; ++batch->nrec ) {
+                    seq_t & rec = batch->recs[batch->nrec];
+
+                    rec.clear();
+
+                    if ( !parser.parse( file, filetype, state, rec, batch->arena, scratch ) ) {
+                        more = false;
+                        break;
+                    }
+
+                    batch->marks[batch->nrec] = file->mark();
+                }
+
+                if ( !full_q.push( batch ) )
+                    break;
+            }
+
+            full_q.close();
+        }
+
+    public:
+        reader_t( parser_t & parser, ifile::ifile_t * file, const filetype_t filetype ) :
+            parser( parser ),
+            file( file ),
+            filetype( filetype ),
+            state( UNKNOWN ),
+            free_q( nbatch ),
+            full_q( nbatch ),
+            curr( NULL ),
+            pos( 0 )
+        {
+            size_t i;
+
+            for ( i = 0; i < nbatch; ++i )
+                free_q.push( &batches[i] );
+
+            thread = std::thread( &reader_t::run, this );
+        }
+
+        ~reader_t()
+        {
+            free_q.close();
+            full_q.close();
+            thread.join();
+        }
+
+        // the next record and where it ends, false once the file is exhausted;
+        // any of its fields in the batch's arena last until the next call
+        bool next( seq_t & rec, ifile::mark_t & mark )
+        {
+            while ( !curr || pos >= curr->nrec ) {
+                if ( curr && curr->nrec < READ_BATCH_SZ )
+                    return false;
+
+                if ( curr )
+                    free_q.push( curr );
+
+                curr = NULL;
+                pos = 0;
+
+                if ( !full_q.pop( curr ) )
+                    return false;
+            }
+
+            rec = curr->recs[pos];
+            mark = curr->marks[pos++];
+
+            return true;
+        }
+    };
+
+    // chunker_t -------------------------------------------------------------------------------------------------- //
+
+    // the end of the line starting at p, i.e. its '\n' or end
+    static inline
+    const char * eol( const char * p, const char * end )
+    {
+        const char * nl = static_cast<const char *>( memchr( p, '\n', end - p ) );
+        return nl ? nl : end;
+    }
+
+    // the length of the line [p, e), less any '\r' ending it
+    static inline
+    size_t line_length( const char * p, const char * e )
+    {
+        return ( e > p && e[-1] == '\r' ) ? e - p - 1 : e - p;
+    }
+
+    static inline
+    const char * next_line( const char * e, const char * end )
+    {
+        return e < end ? e + 1 : end;
+    }
+
+    // whether a FASTQ record begins at p: an '@' line, sequence lines
+    // none of which begin with '@', a '+' line, a quality line as long as
+    // the sequence, then another '@' line or the end of the file.
+    // A quality line may itself begin with '@', but it is always followed
+    // by a header, never by sequence, so it can't pass for one
+    static
+    bool is_record( const char * p, const char * end )
+    {
+        const char * e;
+        size_t nseq = 0;
+
+        if ( p >= end || *p != '@' )
+            return false;
+
+        p = next_line( eol( p, end ), end );
+
+        for ( ; ; p = next_line( e, end ) ) {
+            if ( p >= end || *p == '@' )
+                return false;
+
+            e = eol( p, end );
+
+            if ( *p == '+' )
+                break;
+
+            // the parser takes the sequence up to the first '+' anywhere
+            if ( memchr( p, '+', e - p ) )
+                return false;
+
+            nseq += line_length( p, e );
+        }
+
+        p = next_line( e, end );
+
+        if ( !nseq || p >= end )
+            return false;
+
+        e = eol( p, end );
+
+        if ( line_length( p, e ) != nseq )
+            return false;
+
+        for ( p = next_line( e, end ); p < end && IS_WHITESPACE( *p ); ++p );
+
+        return p == end || *p == '@';
+    }
+
+    // the first record boundary at or after pos in the mapping [begin, end)
+    static
+    const char * resync( const char * begin, const char * pos, const char * end )
+    {
+        const char * p = pos;
+
+        if ( p == begin )
+            return p;
+
+        if ( p[-1] != '\n' )
+            p = next_line( eol( p, end ), end );
+
+        for ( ; p < end; p = next_line( eol( p, end ), end ) ) {
+            if ( is_record( p, end ) )
+                return p;
+        }
+
+        return end;
+    }
+
+    // parses a mapped FASTQ file on nthreads threads, PARSE_CHUNK_SZ bytes at a time.
+    // Each chunk is moved onto the first record boundary at or after its start,
+    // as its predecessor is moved to end there, and is parsed in full into a slot;
+    // slots are handed out in file order, and a thread only moves on to a chunk
+    // once its slot has been drained. Malformed reads are warned about as they
+    // are handed out, so that the warnings come in file order too
+    class chunker_t
+    {
+    private:
+        // a read skipped as malformed, the chunk's recs[rec]
+        class skipped_t
+        {
+        public:
+            size_t rec;
+            ifile::mark_t mark;
+            size_t nbase;
+            size_t nqual;
+        };
+
+        class chunk_t
+        {
+        public:
+            std::vector<seq_t> recs;
+            size_t nrec;
+            std::vector<skipped_t> skipped;
+            arena_t arena;
+            bool done;
+
+            chunk_t() :
+                nrec( 0 ),
+                done( false )
+            {
+            }
+        };
+
+        parser_t & parser;
+        const ifile::ifile_t & file;
+        const char * begin;
+        const char * end;
+        size_t nchunk;
+        std::vector<chunk_t> slots;
+        // the next chunk to be parsed, and the one being drained
+        size_t todo;
+        size_t curr;
+        size_t pos;
+        // the next of the drained chunk's skipped reads to warn about
+        size_t nwarned;
+        bool ready;
+        bool stop;
+        std::mutex lock;
+        std::condition_variable cv;
+        std::vector<std::thread> threads;
+
+        void parse( const size_t k, chunk_t & chunk, scratch_t & scratch )
+        {
+            const size_t from = k * PARSE_CHUNK_SZ,
+                         to = ( k + 1 ) * PARSE_CHUNK_SZ;
+            ifile::ifile_t view(
+                file,
+                resync( begin, begin + from, end ),
+                to < size_t( end - begin ) ? resync( begin, begin + to, end ) : end
+                );
+            state_t state = UNKNOWN;
+
+            chunk.arena.reset();
+            chunk.skipped.clear();
+
+            for ( chunk.nrec = 0; ; ++chunk.nrec ) {
+                if ( chunk.nrec == chunk.recs.size() )
+                    chunk.recs.resize( chunk.nrec + READ_BATCH_SZ );
+
+                seq_t & rec = chunk.recs[chunk.nrec];
+
+                rec.clear();
+
+                if ( !parser.parse( &view, FASTQ, state, rec, chunk.arena, scratch ) )
+                    break;
+
+                // as parser_t::check, but with the warning left to next()
+                if ( rec.seq.length() != rec.quals.size() ) {
+                    const skipped_t skip = { chunk.nrec, view.mark(), rec.seq.length(), rec.quals.size() };
+
+                    chunk.skipped.push_back( skip );
+                    rec.clear();
+                }
+                else
+                    rec.length = rec.seq.length();
+            }
+        }
+
+        void run()
+        {
+            scratch_t scratch;
+
+            while ( true ) {
+                size_t k;
+
+                {
+                    std::unique_lock<std::mutex> guard( lock );
+
+                    cv.wait( guard, [this]() {
+                        return stop || todo >= nchunk || todo < curr + slots.size();
+                    } );
+
+                    if ( stop || todo >= nchunk )
+                        return;
+
+                    k = todo++;
+                }
+
+                parse( k, slots[k % slots.size()], scratch );
+
+                {
+                    std::lock_guard<std::mutex> guard( lock );
+                    slots[k % slots.size()].done = true;
+                }
+
+                cv.notify_all();
+            }
+        }
+
+    public:
+        chunker_t( parser_t & parser, ifile::ifile_t & file, const size_t nthreads ) :
+            parser( parser ),
+            file( file ),
+            begin( NULL ),
+            end( NULL ),
+            nchunk( 0 ),
+            slots( 2 * nthreads ),
+            todo( 0 ),
+            curr( 0 ),
+            pos( 0 ),
+            nwarned( 0 ),
+            ready( false ),
+            stop( false )
+        {
+            size_t i;
+
+            file.mapping( begin, end );
+            file.consume();
+
+            nchunk = ( end - begin + PARSE_CHUNK_SZ - 1 ) / PARSE_CHUNK_SZ;
+
+            for ( i = 0; i < nthreads; ++i )
+                threads.push_back( std::thread( &chunker_t::run, this ) );
+        }
+
+        ~chunker_t()
+        {
+            size_t i;
+
+            {
+                std::lock_guard<std::mutex> guard( lock );
+                stop = true;
+            }
+
+            cv.notify_all();
+
+            for ( i = 0; i < threads.size(); ++i )
+                threads[i].join();
+        }
+
+        // the next record, false once the file is exhausted;
+        // any of its fields in the chunk's arena last until the next call
+        bool next( seq_t & rec )
+        {
+            while ( curr < nchunk ) {
+                chunk_t & chunk = slots[curr % slots.size()];
+
+                if ( !ready ) {
+                    std::unique_lock<std::mutex> guard( lock );
+                    cv.wait( guard, [&chunk]() { return chunk.done; } );
+                    ready = true;
+                }
+
+                if ( pos < chunk.nrec ) {
+                    if ( nwarned < chunk.skipped.size() && chunk.skipped[nwarned].rec == pos ) {
+                        const skipped_t & skip = chunk.skipped[nwarned++];
+
+                        parser_t::malformed( &file, skip.mark, skip.nbase, skip.nqual );
+                    }
+
+                    rec = chunk.recs[pos++];
+                    return true;
+                }
+
+                // drained, so free the slot for a later chunk
+                {
+                    std::lock_guard<std::mutex> guard( lock );
+                    chunk.done = false;
+                    curr += 1;
+                }
+
+                cv.notify_all();
+                pos = 0;
+                nwarned = 0;
+                ready = false;
+            }
+
+            return false;
+        }
+    };
+
+    // parser_t --------------------------------------------------------------------------------------------------- //
+
     const char chr[] = ">\0@\0+";
 
-    parser_t::parser_t( ifile::ifile_t * fastq ) :
+    parser_t::parser_t( ifile::ifile_t * fastq, const size_t nthreads ) :
         fasta( NULL ), 
         fastq( fastq ),
         qual( NULL ), 
         fstate( UNKNOWN ),
         qstate( UNKNOWN ),
         hdr( chr + 2 ),
-        sep( chr + 4 )
+        sep( chr + 4 ),
+        freader( NULL ),
+        qreader( NULL ),
+        chunker( NULL )
     {
+        const char * begin,
+                   * end;
+
+        // only uncompressed files are mapped, and can be cut up
+        if ( nthreads > 1 && fastq->mapping( begin, end ) )
+            chunker = new chunker_t( *this, *fastq, nthreads );
     }
 
     parser_t::parser_t( ifile::ifile_t * fasta, ifile::ifile_t * qual ) :
@@ -45,26 +522,53 @@ namespace seq
         fstate( UNKNOWN ),
         qstate( UNKNOWN ),
         hdr( chr + 0 ),
-        sep( chr + 0 )
+        sep( chr + 0 ),
+        freader( NULL ),
+        qreader( NULL ),
+        chunker( NULL )
+    {
+        freader = new reader_t( *this, fasta, FASTA );
+        qreader = new reader_t( *this, qual, QUAL );
+    }
+
+    parser_t::~parser_t()
     {
+        delete freader;
+        delete qreader;
+        delete chunker;
     }
 
-    bool parser_t::next( seq_t & seq )
+    // point field at the next delimited field of file, if it is a single line
+    // of a memory-mapped file, otherwise gather it in scratch and copy it into arena
+    static inline
+    void extend( ifile::ifile_t * file, field_t<char> & field, const char * delim, arena_t & arena, scratch_t & scratch )
     {
-        ifile::ifile_t * file = fastq ? fastq : fasta;
-        filetype_t filetype = fastq ? FASTQ : FASTA;
-        state_t * state = &fstate;
-    begin:
+        const char * data;
+        size_t len;
+
+        if ( file->view_until( data, len, delim ) )
+            field.view( data, len );
+        else {
+            scratch.text.clear();
+            file->extend_until( scratch.text, delim );
+            field.copy( scratch.text.data(), scratch.text.size(), arena );
+        }
+    }
 
+    // parse a single record from file, QUAL records filling in
+    // only the ID and quality scores. All state is the caller's,
+    // so FASTA and QUAL files can be parsed concurrently
+    bool parser_t::parse( ifile::ifile_t * file, filetype_t filetype, state_t & state, seq_t & seq, arena_t & arena, scratch_t & scratch )
+    {
         do {
-            switch ( *state ) {
+            switch ( state ) {
             case UNKNOWN: {
                 file->skip_ws();
                 {
                     const char chr = file->getc();
 
                     if ( strchr( hdr, chr ) )
-                        *state = ID;
+                        state = ID;
                     else if ( chr == EOF )
                         return false;
                     else
@@ -74,18 +578,15 @@ namespace seq
             }
 
             case ID: {
-                std::string & str = ( filetype == QUAL ) ? qid : seq.id;
-                file->extend_until( str, "\r\n" );
+                extend( file, seq.id, "\r\n", arena, scratch );
 
-                if ( str.length() < 1 )
+                if ( seq.id.length() < 1 )
                     file->error( "malformed file: missing ID" );
 
-                if ( filetype == QUAL ) {
-                    qid.clear();
-                    *state = QUALITY;
-                }
+                if ( filetype == QUAL )
+                    state = QUALITY;
                 else
-                    *state = SEQUENCE;
+                    state = SEQUENCE;
 
                 break;
             }
@@ -94,19 +595,26 @@ namespace seq
                 switch ( filetype ) {
                 case FASTA:
                 case FASTQ: {
-                    file->extend_until( seq.seq, sep );
+                    extend( file, seq.seq, sep, arena, scratch );
 
                     if ( !seq.seq.length() )
                         file->error( "malformed file: missing sequence" );
 
                     if ( filetype == FASTA )
-                        *state = UNKNOWN;
+                        state = UNKNOWN;
                     else { // FASTQ
+                        const char * data;
+                        size_t len;
+
                         // skip over the + separator and any trailing whitespace
                         file->getc();
-                        file->extend_until( qid, "\r\n" );
-                        qid.clear();
-                        *state = QUALITY;
+
+                        if ( !file->view_until( data, len, "\r\n" ) ) {
+                            scratch.text.clear();
+                            file->extend_until( scratch.text, "\r\n" );
+                        }
+
+                        state = QUALITY;
                     }
 
                     break;
@@ -120,34 +628,37 @@ namespace seq
             }
 
             case QUALITY: {
-                // FASTQ files permit '@' to appear as a valid quality value (31),
-                // so look for a newline instead of the hdr
-                file->extend_until( qs, ( filetype == QUAL ) ? hdr : "\r\n", false );
-
-                if ( qs.length() < 1 )
-                    file->error( "malformed file: missing quality scores" );
-
                 if ( filetype == QUAL ) {
-                    char * buf = NULL;
-
-                    strtok_t tok( qs.c_str() );
+                    scratch.scores.clear();
+                    file->extend_scores( scratch.scores, hdr );
+                    seq.quals.copy( scratch.scores.data(), scratch.scores.size(), arena );
+                    seq.offset = 0;
 
-                    while ( ( buf = tok.next( " \t\r\n" ) ) )
-                        seq.quals.push_back( atoi( buf ) );
+                    if ( seq.quals.size() < 1 )
+                        file->error( "malformed file: missing quality scores" );
                 }
                 else { // FASTQ
-                    size_t i;
-
-                    for ( i = 0; i < qs.length(); ++i ) {
-                        // encoding: chr(phred+33)
-                        seq.quals.push_back( long( qs[i] ) - 33 );
+                    // FASTQ files permit '@' to appear as a valid quality value (31),
+                    // so look for a newline instead of the hdr.
+                    // encoding: chr(phred+33), kept raw and decoded by whoever needs it
+                    const char * data;
+                    size_t len;
+
+                    if ( file->view_until( data, len, "\r\n", false ) )
+                        seq.quals.view( reinterpret_cast<const unsigned char *>( data ), len );
+                    else {
+                        scratch.scores.clear();
+                        file->extend_bytes( scratch.scores, "\r\n" );
+                        seq.quals.copy( scratch.scores.data(), scratch.scores.size(), arena );
                     }
-                }
 
-                // clear the qual data after use
-                qs.clear();
+                    seq.offset = 33;
+
+                    if ( seq.quals.size() < 1 )
+                        file->error( "malformed file: missing quality scores" );
+                }
 
-                *state = UNKNOWN;
+                state = UNKNOWN;
                 break;
             }
 
@@ -155,27 +666,120 @@ namespace seq
                 MALFUNCTION();
             }
         }
-        while ( *state != UNKNOWN );
+        while ( state != UNKNOWN );
+
+        return true;
+    }
+
+    // IDs agree if they match up to the first whitespace,
+    // as some tools add or drop trailing fields in one file or the other
+    static
+    bool same_id( const field_t<char> & a, const field_t<char> & b )
+    {
+        size_t i;
+
+        for ( i = 0; i < a.length() && i < b.length() && !IS_WHITESPACE( a[i] ); ++i ) {
+            if ( a[i] != b[i] )
+                return false;
+        }
+
+        return ( i == a.length() || IS_WHITESPACE( a[i] ) ) && ( i == b.length() || IS_WHITESPACE( b[i] ) );
+    }
+
+    // the length of an ID up to the first whitespace, less a /1 or /2 mate suffix
+    static
+    size_t pair_id_length( const field_t<char> & id )
+    {
+        size_t i;
 
-        if ( qual && file == fasta ) {
+        for ( i = 0; i < id.length() && !IS_WHITESPACE( id[i] ); ++i ) ;
+
+        if ( i >= 2 && id[i - 2] == '/' && ( id[i - 1] == '1' || id[i - 1] == '2' ) )
+            i -= 2;
+
+        return i;
+    }
+
+    bool same_mates( const field_t<char> & a, const field_t<char> & b )
+    {
+        const size_t n = pair_id_length( a );
+
+        return n == pair_id_length( b ) && ( !n || !memcmp( a.data(), b.data(), n ) );
+    }
+
+    bool parser_t::next( seq_t & seq, arena_t & arena )
+    {
+        ifile::ifile_t * file = fastq;
+        ifile::mark_t mark;
+
+        if ( chunker ) {
+            if ( !chunker->next( seq ) )
+                return false;
+
+            // already checked, on the thread that parsed it
+            seq.keep( arena );
+
+            return true;
+        }
+
+        if ( fastq ) {
+            if ( !parse( fastq, FASTQ, fstate, seq, arena, scratch ) )
+                return false;
+
+            mark = fastq->mark();
+        }
+        else {
+            // records are paired up by position
+            if ( !freader->next( seq, mark ) )
+                return false;
+
+            seq.keep( arena );
+
+            qrec.clear();
+
+            // positions are those saved by the reader threads, which
+            // have read on by now
+            if ( !qreader->next( qrec, mark ) )
+                return false;
+
+            if ( !same_id( seq.id, qrec.id ) )
+                qual->error_at(
+                    mark,
+                    "FASTA and QUAL record IDs do not match: %.*s, %.*s",
+                    int( seq.id.length() ),
+                    seq.id.data(),
+                    int( qrec.id.length() ),
+                    qrec.id.data()
+                    );
+
+            seq.quals = qrec.quals;
+            seq.quals.keep( arena );
+            seq.offset = qrec.offset;
             file = qual;
-            filetype = QUAL;
-            state = &qstate;
-            goto begin;
         }
 
-        if ( ( qual || fastq ) && seq.seq.length() != seq.quals.size() ) {
-            file->warning(
-                "skipping malformed read: sequence length (%ld) does not match the number of quality scores (%ld)",
-                seq.seq.length(),
-                seq.quals.size()
-            );
+        check( file, mark, seq );
+
+        return true;
+    }
+
+    void parser_t::check( ifile::ifile_t * file, const ifile::mark_t & mark, seq_t & seq )
+    {
+        if ( seq.seq.length() != seq.quals.size() ) {
+            malformed( file, mark, seq.seq.length(), seq.quals.size() );
             seq.clear();
-            return true;
         }
         else
             seq.length = seq.seq.length();
+    }
 
-        return true;
+    void parser_t::malformed( const ifile::ifile_t * file, const ifile::mark_t & mark, const size_t nbase, const size_t nqual )
+    {
+        file->warning_at(
+            mark,
+            "skipping malformed read: sequence length (%ld) does not match the number of quality scores (%ld)",
+            nbase,
+            nqual
+        );
     }
 }
@@ -3,11 +3,20 @@
 #define SEQ_H
 
 #include <cstdio>
+#include <cstring>
 #include <string>
+#include <utility>
 #include <vector>
 
 #include "ifile.hpp"
 
+// records a FASTA or QUAL reader thread hands over at a time
+#define READ_BATCH_SZ 256
+// bytes of a mapped FASTQ file parsed at a time, when parsing on several threads
+#define PARSE_CHUNK_SZ ( 1 << 20 )
+// the smallest block an arena allocates
+#define ARENA_BLOCK_SZ ( 1 << 18 )
+
 namespace seq
 {
     enum state_t {
@@ -23,17 +32,124 @@ namespace seq
         FASTQ
     };
 
+    // a bump-pointer allocator for the fields of a batch of records;
+    // its blocks are kept across reset(), so once it has grown to hold
+    // a batch, refilling it allocates nothing
+    class arena_t
+    {
+    private:
+        std::vector< std::pair<char *, size_t> > blocks;
+        // the block being allocated from, and the bytes used of it
+        size_t block;
+        size_t used;
+
+        arena_t( const arena_t & );
+        arena_t & operator=( const arena_t & );
+
+    public:
+        arena_t();
+        ~arena_t();
+        char * alloc( const size_t );
+        // free everything allocated, all at once
+        void reset();
+
+        template <typename T>
+        const T * copy( const T * data, const size_t n ) {
+            char * const dst = alloc( n * sizeof( T ) );
+            memcpy( dst, data, n * sizeof( T ) );
+            return reinterpret_cast<const T *>( dst );
+        }
+    };
+
+    // a record field: a view of either a single line of a memory-mapped input,
+    // or a copy in the arena of the batch the record was read into,
+    // for streamed input and fields that span lines and must be joined
+    template <typename T>
+    class field_t
+    {
+    private:
+        const T * ptr;
+        size_t len;
+        // in an arena, rather than a mapping
+        bool copied;
+
+    public:
+        field_t() :
+            ptr( NULL ),
+            len( 0 ),
+            copied( false )
+        {
+        }
+
+        inline const T * data() const { return ptr; }
+        inline size_t length() const { return len; }
+        inline size_t size() const { return len; }
+        inline const T & operator[]( const size_t i ) const { return ptr[i]; }
+
+        inline
+        void view( const T * data, const size_t n ) {
+            ptr = data;
+            len = n;
+            copied = false;
+        }
+
+        inline
+        void copy( const T * data, const size_t n, arena_t & arena ) {
+            ptr = arena.copy( data, n );
+            len = n;
+            copied = true;
+        }
+
+        // copy a field out of another arena, about to be reset, into arena
+        inline
+        void keep( arena_t & arena ) {
+            if ( copied )
+                ptr = arena.copy( ptr, len );
+        }
+
+        inline
+        void clear() {
+            ptr = NULL;
+            len = 0;
+            copied = false;
+        }
+    };
+
     class seq_t
     {
     public:
-        std::string id;
-        std::string seq;
-        std::vector<size_t> quals;
+        field_t<char> id;
+        field_t<char> seq;
+        // quality scores, one byte per base, raw as read: each score is
+        // its byte less offset (33 for FASTQ, 0 for QUAL, which is decoded
+        // as it is parsed)
+        field_t<unsigned char> quals;
+        unsigned char offset;
         size_t length;
         seq_t();
+
+        // the decoded score of base i
+        inline
+        unsigned char quality( const size_t i ) const {
+            return ( quals[i] > offset ) ? quals[i] - offset : 0;
+        }
+
         void clear();
+        void keep( arena_t & );
     };
 
+    // a parsing thread's buffers, for fields that are gathered
+    // before they are copied into an arena
+    class scratch_t
+    {
+    public:
+        std::string text;
+        std::vector<unsigned char> scores;
+    };
+
+    class reader_t;
+    class chunker_t;
+
     class parser_t
     {
     private:
@@ -48,14 +164,37 @@ namespace seq
         const char * const sep;
 
         // these are permanent static buffer
-        std::string qid;
-        std::string qs;
+        scratch_t scratch;
+
+        // FASTA and QUAL are each parsed on a thread of their own
+        reader_t * freader;
+        reader_t * qreader;
+        seq_t qrec;
+
+        // and a mapped FASTQ file is parsed a chunk at a time on several
+        chunker_t * chunker;
+
+        parser_t( const parser_t & );
+        parser_t & operator=( const parser_t & );
 
     public:
-        parser_t( ifile::ifile_t * );
+        parser_t( ifile::ifile_t *, const size_t nthreads=1 );
         parser_t( ifile::ifile_t *, ifile::ifile_t * );
-        bool next( seq_t & );
+        ~parser_t();
+        // fields that can't be views of a mapping are gathered in scratch and copied into arena
+        bool parse( ifile::ifile_t *, filetype_t, state_t &, seq_t &, arena_t &, scratch_t & );
+        // skip (clear) a read with a different number of bases and quality scores,
+        // with a warning at mark, where the read ends
+        static void check( ifile::ifile_t *, const ifile::mark_t &, seq_t & );
+        // the warning check gives, for a read of nbase bases and nqual scores
+        static void malformed( const ifile::ifile_t *, const ifile::mark_t &, const size_t nbase, const size_t nqual );
+        // the next read, valid until arena is reset
+        bool next( seq_t &, arena_t & );
     };
+
+    // whether two reads' IDs name mates of the same pair: they match up to
+    // the first whitespace, less a /1 or /2 at the end
+    bool same_mates( const field_t<char> &, const field_t<char> & );
 }
 
 #endif // SEQ_H
@@ -0,0 +1,101 @@
+
+#include "stats.hpp"
+
+namespace stats
+{
+    lengths_t::lengths_t() :
+        n( 0 ),
+        mean_( 0. ),
+        m2( 0. )
+    {
+    }
+
+    void lengths_t::add( const size_t len )
+    {
+        const double delta = len - mean_;
+
+        if ( len >= hist.size() )
+            hist.resize( len + 1, 0 );
+
+        hist[len] += 1;
+        n += 1;
+        mean_ += delta / n;
+        m2 += delta * ( len - mean_ );
+    }
+
+    // combine the running moments of two sets (Chan et al.)
+    void lengths_t::merge( const lengths_t & other )
+    {
+        size_t i;
+
+        if ( !other.n )
+            return;
+
+        if ( other.hist.size() > hist.size() )
+            hist.resize( other.hist.size(), 0 );
+
+        for ( i = 0; i < other.hist.size(); ++i )
+            hist[i] += other.hist[i];
+
+        if ( !n ) {
+            n = other.n;
+            mean_ = other.mean_;
+            m2 = other.m2;
+        }
+        else {
+            const size_t total = n + other.n;
+            const double delta = other.mean_ - mean_;
+
+            mean_ += delta * other.n / total;
+            m2 += other.m2 + delta * delta * ( double( n ) * other.n / total );
+            n = total;
+        }
+    }
+
+    size_t lengths_t::count() const
+    {
+        return n;
+    }
+
+    double lengths_t::mean() const
+    {
+        return mean_;
+    }
+
+    double lengths_t::variance() const
+    {
+        return n ? m2 / ( n - 1 ) : 0.;
+    }
+
+    size_t lengths_t::min() const
+    {
+        return n ? at( 0 ) : 0;
+    }
+
+    size_t lengths_t::max() const
+    {
+        return n ? hist.size() - 1 : 0;
+    }
+
+    size_t lengths_t::at( size_t k ) const
+    {
+        size_t len;
+
+        for ( len = 0; len < hist.size(); ++len ) {
+            if ( k < hist[len] )
+                return len;
+
+            k -= hist[len];
+        }
+
+        return max();
+    }
+
+    double lengths_t::median() const
+    {
+        if ( !n )
+            return 0.;
+
+        return ( n % 2 ) ? 1.0 * at( n / 2 ) : 0.5 * ( at( n / 2 ) + at( n / 2 - 1 ) );
+    }
+}
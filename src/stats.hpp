@@ -0,0 +1,35 @@
+
+#ifndef STATS_H
+#define STATS_H
+
+#include <cstddef>
+#include <vector>
+
+namespace stats
+{
+    // streaming length distribution: an exact histogram of lengths,
+    // bounded by the longest one seen, with a running (Welford) mean and variance
+    class lengths_t
+    {
+    private:
+        std::vector<size_t> hist;
+        size_t n;
+        double mean_;
+        double m2;
+
+    public:
+        lengths_t();
+        void add( const size_t );
+        void merge( const lengths_t & );
+        size_t count() const;
+        double mean() const;
+        double variance() const;
+        size_t min() const;
+        size_t max() const;
+        // the k-th smallest length (0-based), as if the lengths were sorted
+        size_t at( size_t k ) const;
+        double median() const;
+    };
+}
+
+#endif // STATS_H
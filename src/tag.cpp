@@ -0,0 +1,347 @@
+
+#include <cctype>
+#include <cstring>
+
+#include "tag.hpp"
+
+#define ONES UINT64_C( 0x0101010101010101 )
+#define LOWS UINT64_C( 0x5555555555555555 )
+
+namespace tag
+{
+    static inline
+    unsigned popcount( uint64_t x )
+    {
+#if defined( __GNUC__ )
+        return __builtin_popcountll( x );
+#else
+        x = x - ( ( x >> 1 ) & LOWS );
+        x = ( x & UINT64_C( 0x3333333333333333 ) ) + ( ( x >> 2 ) & UINT64_C( 0x3333333333333333 ) );
+        x = ( x + ( x >> 4 ) ) & UINT64_C( 0x0f0f0f0f0f0f0f0f );
+        return ( x * ONES ) >> 56;
+#endif
+    }
+
+    // 0x80 in each zero byte of x, and nothing elsewhere
+    static inline
+    uint64_t zero_bytes( const uint64_t x )
+    {
+        return ~( ( ( x & ( 0x7f * ONES ) ) + 0x7f * ONES ) | x | 0x7f * ONES );
+    }
+
+    // gather a 2-bit field from the bottom of each byte into 16 contiguous bits
+    static inline
+    uint64_t compact( uint64_t x )
+    {
+        x = ( x | ( x >> 6 ) ) & UINT64_C( 0x000f000f000f000f );
+        x = ( x | ( x >> 12 ) ) & UINT64_C( 0x000000ff000000ff );
+        return ( x | ( x >> 24 ) ) & UINT64_C( 0xffff );
+    }
+
+    // pack n (up to 8) bases: two bits of code each, and in other,
+    // the low bit of the two set for anything but A, C, G or T
+    static inline
+    void pack( const char * bases, const size_t n, uint64_t & code, uint64_t & other )
+    {
+        uint64_t x = 0,
+                 up,
+                 acgt;
+
+        memcpy( &x, bases, n );
+
+        // clearing bit 5 uppercases a letter, and takes nothing else to one
+        up = x & ( 0xdf * ONES );
+        acgt = zero_bytes( up ^ ( 'A' * ONES ) )
+             | zero_bytes( up ^ ( 'C' * ONES ) )
+             | zero_bytes( up ^ ( 'G' * ONES ) )
+             | zero_bytes( up ^ ( 'T' * ONES ) );
+
+        // A 0, C 1, T 2, G 3
+        code = compact( ( x >> 1 ) & ( 0x03 * ONES ) );
+        other = compact( ( ~acgt >> 7 ) & ONES );
+    }
+
+    // the low bit of each of the first n bases' two
+    static inline
+    uint64_t low_bits( const size_t n )
+    {
+        return ( n < TAG_WORD_BASES ) ? LOWS & ( ( UINT64_C( 1 ) << ( 2 * n ) ) - 1 ) : LOWS;
+    }
+
+    // pack the first n (up to TAG_WORD_BASES) bases into a word, as above;
+    // the zero padding past n is A to code, and left out of other
+    static inline
+    void pack_word( const char * bases, const size_t n, uint64_t & code, uint64_t & other )
+    {
+        size_t i;
+
+        code = 0;
+        other = 0;
+
+        for ( i = 0; i < n; i += 8 ) {
+            uint64_t c, o;
+
+            pack( bases + i, ( n - i < 8 ) ? n - i : 8, c, o );
+            code |= c << ( 2 * i );
+            other |= o << ( 2 * i );
+        }
+
+        other &= low_bits( n );
+    }
+
+    static inline
+    uint64_t hash( const uint64_t code )
+    {
+        return code * UINT64_C( 0x9e3779b97f4a7c15 );
+    }
+
+    // matcher_t ---------------------------------------------------------------------------------------------------- //
+
+    matcher_t::matcher_t( const std::string & tag ) :
+        tag( tag )
+    {
+        size_t pos, i;
+
+        for ( pos = 0; pos < tag.length(); pos += TAG_WORD_BASES ) {
+            const size_t n = ( tag.length() - pos < TAG_WORD_BASES ) ? tag.length() - pos : TAG_WORD_BASES;
+            uint64_t code, other;
+
+            pack_word( tag.data() + pos, n, code, other );
+            codes.push_back( code );
+            acgt.push_back( ~other & low_bits( n ) );
+        }
+
+        for ( i = 0; i < tag.length(); ++i ) {
+            const char chr = toupper( tag[i] );
+
+            if ( chr != 'A' && chr != 'C' && chr != 'G' && chr != 'T' )
+                others.push_back( i );
+        }
+    }
+
+    size_t matcher_t::mismatches( const char * bases, const size_t limit ) const
+    {
+        size_t nmismatch = 0,
+               w, i;
+
+        for ( w = 0; w < codes.size(); ++w ) {
+            const size_t pos = w * TAG_WORD_BASES;
+            uint64_t code, other, diff;
+
+            pack_word( bases + pos, ( tag.length() - pos < TAG_WORD_BASES ) ? tag.length() - pos : TAG_WORD_BASES, code, other );
+
+            // a base mismatches if either bit of its code differs, or it isn't A, C, G or T
+            diff = code ^ codes[w];
+            nmismatch += popcount( ( diff | ( diff >> 1 ) | other ) & acgt[w] );
+
+            if ( nmismatch > limit )
+                return nmismatch;
+        }
+
+        for ( i = 0; i < others.size() && nmismatch <= limit; ++i ) {
+            if ( toupper( bases[others[i]] ) != toupper( tag[others[i]] ) )
+                nmismatch += 1;
+        }
+
+        return nmismatch;
+    }
+
+    // searcher_t --------------------------------------------------------------------------------------------------- //
+
+    const size_t searcher_t::npos;
+
+    searcher_t::searcher_t( const std::string & tag ) :
+        len( tag.length() )
+    {
+        size_t c, i;
+
+        // case insensitive, as with matcher_t
+        for ( c = 0; c < 256; ++c ) {
+            peq[c] = 0;
+
+            for ( i = 0; i < len; ++i )
+                if ( toupper( int( c ) ) == toupper( static_cast<unsigned char>( tag[i] ) ) )
+                    peq[c] |= UINT64_C( 1 ) << i;
+        }
+    }
+
+    size_t searcher_t::find( const char * bases, const size_t n, const size_t max ) const
+    {
+        // Pv and Mv: the vertical deltas of the column (+1, -1), all +1 to start;
+        // the start of the alignment is free, so the top row is all 0
+        const uint64_t last = UINT64_C( 1 ) << ( len - 1 );
+        uint64_t pv = ~UINT64_C( 0 ),
+                 mv = 0;
+        size_t score = len,
+               best = max + 1,
+               end = npos,
+               j;
+
+        for ( j = 0; j < n; ++j ) {
+            const uint64_t eq = peq[static_cast<unsigned char>( bases[j] )],
+                           xv = eq | mv,
+                           xh = ( ( ( eq & pv ) + pv ) ^ pv ) | eq;
+            uint64_t ph = mv | ~( xh | pv ),
+                     mh = pv & xh;
+
+            if ( ph & last )
+                score += 1;
+            else if ( mh & last )
+                score -= 1;
+
+            ph <<= 1;
+            mh <<= 1;
+            pv = mh | ~( xv | ph );
+            mv = ph & xv;
+
+            if ( score < best ) {
+                best = score;
+                end = j + 1;
+            }
+            else if ( score == best && end == j )
+                end = j + 1;
+            // nothing can beat an exact match, once its run is over
+            else if ( best == 0 )
+                break;
+        }
+
+        return end;
+    }
+
+    // index_t ------------------------------------------------------------------------------------------------------ //
+
+    const size_t index_t::none;
+    const size_t index_t::ambiguous;
+
+    index_t::index_t( const std::vector<std::string> & barcodes, const size_t max_mismatch ) :
+        len( barcodes.size() ? barcodes[0].length() : 0 ),
+        max( ( max_mismatch < len ) ? max_mismatch : len ),
+        shift( 64 )
+    {
+        size_t nslot = 1,
+               nentry = 1,
+               term = 1,
+               i;
+
+        if ( barcodes.empty() )
+            return;
+
+        // the sequences within max of each barcode: sum over i <= max of C(len, i) 3^i
+        for ( i = 1; i <= max && nentry * barcodes.size() <= TAG_INDEX_MAX; ++i ) {
+            term = term * ( len - i + 1 ) * 3 / i;
+            nentry += term;
+        }
+
+        for ( i = 0; i < barcodes.size(); ++i )
+            matchers.push_back( matcher_t( barcodes[i] ) );
+
+        // too many to index: every read is matched one barcode at a time
+        if ( nentry * barcodes.size() > TAG_INDEX_MAX )
+            return;
+
+        while ( nslot < TAG_INDEX_LOAD * nentry * barcodes.size() ) {
+            nslot <<= 1;
+            shift -= 1;
+        }
+
+        slot_t empty = { 0, none, 0 };
+        slots.assign( nslot, empty );
+
+        for ( i = 0; i < barcodes.size(); ++i ) {
+            uint64_t code, other;
+
+            pack_word( barcodes[i].data(), len, code, other );
+            insert( code, i, 0 );
+            insert_neighbours( code, i, 0, 0 );
+        }
+    }
+
+    // index code, distance away from barcode, unless another barcode is nearer
+    void index_t::insert( const uint64_t code, const size_t barcode, const size_t distance )
+    {
+        size_t i = shift < 64 ? hash( code ) >> shift : 0;
+
+        for ( ; slots[i].barcode != none; i = ( i + 1 ) & ( slots.size() - 1 ) ) {
+            slot_t & slot = slots[i];
+
+            if ( slot.code != code )
+                continue;
+
+            if ( distance < slot.distance ) {
+                slot.barcode = barcode;
+                slot.distance = distance;
+            }
+            else if ( distance == slot.distance && barcode != slot.barcode )
+                slot.barcode = ambiguous;
+
+            return;
+        }
+
+        slots[i].code = code;
+        slots[i].barcode = barcode;
+        slots[i].distance = distance;
+    }
+
+    // index each sequence one more substitution, at or after from, away from code
+    void index_t::insert_neighbours( const uint64_t code, const size_t barcode, const size_t from, const size_t distance )
+    {
+        size_t pos;
+        uint64_t x;
+
+        if ( distance >= max )
+            return;
+
+        for ( pos = from; pos < len; ++pos ) {
+            for ( x = 1; x < 4; ++x ) {
+                const uint64_t neighbour = code ^ ( x << ( 2 * pos ) );
+
+                insert( neighbour, barcode, distance + 1 );
+                insert_neighbours( neighbour, barcode, pos + 1, distance + 1 );
+            }
+        }
+    }
+
+    bool index_t::indexed( const char * bases ) const
+    {
+        uint64_t code, other;
+
+        pack_word( bases, len, code, other );
+
+        return !other && !slots.empty();
+    }
+
+    size_t index_t::find( const char * bases ) const
+    {
+        uint64_t code, other;
+        size_t i;
+
+        pack_word( bases, len, code, other );
+
+        if ( !other && !slots.empty() ) {
+            for ( i = shift < 64 ? hash( code ) >> shift : 0; slots[i].barcode != none; i = ( i + 1 ) & ( slots.size() - 1 ) ) {
+                if ( slots[i].code == code )
+                    return slots[i].barcode;
+            }
+
+            return none;
+        }
+        else {
+            // no index, or an N, which counts as a mismatch, as with a single tag
+            size_t best = none,
+                   nbest = max + 1;
+
+            for ( i = 0; i < matchers.size(); ++i ) {
+                const size_t n = matchers[i].mismatches( bases, max );
+
+                if ( n < nbest ) {
+                    best = i;
+                    nbest = n;
+                }
+                else if ( n == nbest && n <= max )
+                    best = ambiguous;
+            }
+
+            return best;
+        }
+    }
+}
@@ -0,0 +1,111 @@
+
+#ifndef TAG_H
+#define TAG_H
+
+#include <cstddef>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+// bases of a tag packed into each word
+#define TAG_WORD_BASES 32
+// the longest tag searched for with edits: a word's worth of bases
+#define TAG_SEARCH_BASES 64
+// barcode index slots per indexed sequence, at least
+#define TAG_INDEX_LOAD 2
+// sequences indexed over all barcodes, at most; with more mismatches
+// than that allows, reads are matched barcode by barcode instead
+#define TAG_INDEX_MAX ( 1 << 20 )
+
+// 5' tag matching: the tag is packed two bits per base (A, C, G and T, in
+// either case, by bits 1-2 of their ASCII codes), and each read's prefix is
+// packed eight bases at a time as it is compared, along with a mask of the
+// bases that are anything else (e.g. N). Mismatches are then counted by XOR
+// and popcount, a word at a time
+namespace tag
+{
+    class matcher_t
+    {
+    private:
+        std::string tag;
+        std::vector<uint64_t> codes;
+        // a bit (the low bit of the base's two) for each A, C, G or T of the tag
+        std::vector<uint64_t> acgt;
+        // positions of the tag's other characters, compared as characters
+        std::vector<size_t> others;
+
+    public:
+        matcher_t( const std::string & );
+        inline size_t length() const { return tag.length(); }
+        // the mismatches, case insensitively, between the tag and the first
+        // length() bases, stopping as soon as there are more than limit
+        size_t mismatches( const char *, const size_t limit ) const;
+    };
+
+    // a tag of up to TAG_SEARCH_BASES bases, found anywhere in a read's
+    // first bases with substitutions, insertions and deletions, by Myers'
+    // bit-parallel edit distance: the edit distance of the best alignment of
+    // the tag ending at each base, for all the tag's bases at once in a word
+    class searcher_t
+    {
+    private:
+        size_t len;
+        // for each character, a bit for each base of the tag it matches
+        uint64_t peq[256];
+
+    public:
+        static const size_t npos = size_t( -1 );
+
+        // the tag must be at most TAG_SEARCH_BASES long
+        searcher_t( const std::string & );
+        inline size_t length() const { return len; }
+        // one past the end of the nearest alignment of the tag within the first
+        // n bases, if it is within max edits, otherwise npos; of equally near
+        // alignments, the first, extended through any that end right after it
+        // (as when the read has an extra base of a homopolymer in the tag)
+        size_t find( const char *, const size_t n, const size_t max ) const;
+    };
+
+    // barcodes of a single length (of A, C, G and T, up to TAG_WORD_BASES),
+    // for demultiplexing: every sequence within max mismatches of a barcode
+    // is indexed, by its packed code, to the barcode nearest it, so a read's
+    // barcode is found with a single lookup. A sequence equally near two
+    // barcodes matches neither, but is ambiguous
+    class index_t
+    {
+    private:
+        class slot_t
+        {
+        public:
+            uint64_t code;
+            size_t barcode;
+            size_t distance;
+        };
+
+        size_t len;
+        size_t max;
+        std::vector<slot_t> slots;
+        unsigned shift;
+        // for reads with anything but A, C, G or T in their barcode
+        std::vector<matcher_t> matchers;
+
+        void insert( const uint64_t, const size_t, const size_t );
+        void insert_neighbours( const uint64_t, const size_t, const size_t, const size_t );
+
+    public:
+        // what find() returns when no barcode, or more than one, is nearest
+        static const size_t none = size_t( -1 );
+        static const size_t ambiguous = size_t( -2 );
+
+        index_t( const std::vector<std::string> &, const size_t max_mismatch );
+        inline size_t length() const { return len; }
+        inline size_t size() const { return matchers.size(); }
+        // whether the first length() bases are all A, C, G or T, and there
+        // is an index, so they are looked up in it, rather than matched one by one
+        bool indexed( const char * ) const;
+        // the barcode the first length() bases match, if any
+        size_t find( const char * ) const;
+    };
+}
+
+#endif // TAG_H
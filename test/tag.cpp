@@ -0,0 +1,118 @@
+
+// barcode index lookups, for barcodes of lengths that do and don't fill whole packed bytes,
+// and barcodes matched one by one, with more mismatches than are indexed
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include "tag.hpp"
+
+static const char acgt[] = "ACGT";
+static unsigned long state = 12345UL;
+
+static
+unsigned next_random()
+{
+    state = state * 6364136223846793005UL + 1442695040888963407UL;
+    return unsigned( state >> 33 );
+}
+
+static
+size_t distance( const std::string & a, const std::string & b )
+{
+    size_t n = 0, i;
+
+    for ( i = 0; i < a.length(); ++i )
+        n += ( a[i] != b[i] ) ? 1 : 0;
+
+    return n;
+}
+
+// nbarcode barcodes of len bases, at least 3 apart, so one mismatch is never ambiguous
+static
+std::vector<std::string> barcodes( const size_t nbarcode, const size_t len )
+{
+    std::vector<std::string> list;
+
+    while ( list.size() < nbarcode ) {
+        std::string barcode;
+        size_t i;
+
+        for ( i = 0; i < len; ++i )
+            barcode += acgt[next_random() % 4];
+
+        for ( i = 0; i < list.size() && distance( list[i], barcode ) >= 3; ++i ) ;
+
+        if ( i == list.size() )
+            list.push_back( barcode );
+    }
+
+    return list;
+}
+
+int main()
+{
+    const size_t lens[] = { 8, 12, 16, 20, 31, 32 };
+    size_t nfail = 0,
+           l, i;
+
+    for ( l = 0; l < sizeof( lens ) / sizeof( lens[0] ); ++l ) {
+        const std::vector<std::string> list = barcodes( 96, lens[l] );
+        const tag::index_t index( list, 1 );
+
+        for ( i = 0; i < list.size(); ++i ) {
+            // a read runs on past its barcode
+            std::string read = list[i] + "ACGTACGT",
+                        mismatch = read,
+                        ambig = read;
+            const size_t pos = next_random() % lens[l];
+
+            mismatch[pos] = ( mismatch[pos] == 'A' ) ? 'C' : 'A';
+            ambig[pos] = 'N';
+
+            if ( !index.indexed( read.c_str() ) || !index.indexed( mismatch.c_str() ) ) {
+                fprintf( stderr, "%lu-base barcode %s not looked up in the index\n", ( unsigned long ) lens[l], list[i].c_str() );
+                nfail += 1;
+            }
+
+            if ( index.indexed( ambig.c_str() ) ) {
+                fprintf( stderr, "%lu-base barcode %s with an N looked up in the index\n", ( unsigned long ) lens[l], list[i].c_str() );
+                nfail += 1;
+            }
+
+            if ( index.find( read.c_str() ) != i || index.find( mismatch.c_str() ) != i || index.find( ambig.c_str() ) != i ) {
+                fprintf( stderr, "%lu-base barcode %s not found\n", ( unsigned long ) lens[l], list[i].c_str() );
+                nfail += 1;
+            }
+        }
+    }
+
+    // 96 * C(32, 4) * 3^4 sequences within 4 of a barcode is past TAG_INDEX_MAX
+    {
+        const std::vector<std::string> list = barcodes( 96, 32 );
+        const tag::index_t index( list, 4 );
+
+        for ( i = 0; i < list.size(); ++i ) {
+            std::string read = list[i] + "ACGTACGT";
+
+            read[0] = ( read[0] == 'A' ) ? 'C' : 'A';
+
+            if ( index.indexed( read.c_str() ) ) {
+                fprintf( stderr, "32-base barcode %s looked up in an index too large to build\n", list[i].c_str() );
+                nfail += 1;
+            }
+
+            if ( index.find( read.c_str() ) != i ) {
+                fprintf( stderr, "32-base barcode %s not found with up to 4 mismatches\n", list[i].c_str() );
+                nfail += 1;
+            }
+        }
+    }
+
+    if ( nfail )
+        fprintf( stderr, "%lu failures\n", ( unsigned long ) nfail );
+
+    return nfail ? EXIT_FAILURE : EXIT_SUCCESS;
+}